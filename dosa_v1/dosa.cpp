@@ -1,61 +1,319 @@
 #include <Arduino.h>
+#include <EEPROM.h>
 #include <avr/wdt.h>
 
 #include <bridge_device.h>
 #include <dosa.h>
+#include <eeprom_writer.h>
 #include <utils.h>
 
 #define ON true
 #define OFF false
 
-#define DOSE_TIME_MS (this->ph_dose_time_s * 1000)
+// time a statement into a perf stage, just the statement when profiling is compiled out
+#ifdef DOSA_PROFILE
+#define PERF_TIME(stage, statement) do {                    \
+        unsigned long perf_start = PERF_CLOCK();            \
+        statement;                                          \
+        this->perf.add(stage, PERF_CLOCK() - perf_start);   \
+    } while (0)
+#else
+#define PERF_TIME(stage, statement) statement
+#endif
+
+#ifdef DOSA_TRACE
+#define TRACE(kind, id, value) this->trace(kind, id, value)
+#else
+#define TRACE(kind, id, value)
+#endif
 
 const char *Dosa = "dosa";
-int dosa_instance_count = 0;
+DOSA_GLOBAL int dosa_instance_count = 0;
+
+enum control_topic_id : uint8_t {
+    control_unknown,
+    control_flow_rate,
+    control_ratio_of_A_to_B,
+    control_ec_dose,
+    control_ph_dose,
+    control_run_mixture,
+    control_ph_dose_time,
+    control_dose_lockout,
+    control_closed_loop,
+    control_ec_setpoint,
+    control_ec_reading,
+    control_ph_setpoint,
+    control_ph_reading,
+    control_batch,
+    control_trace_dump,
+    control_recipe,
+    control_time_of_day
+};
+
+#ifdef __AVR__
+static_assert(sizeof(Dosa_Cls) * DOSA_MAX_INSTANCES <= DOSA_RAM_BUDGET,
+              "dosa instances exceed DOSA_RAM_BUDGET, lower DOSA_MAX_INSTANCES or EVENT_LOG_SIZE");
+static_assert(DOSA_MAX_INSTANCES * (SNAPSHOT_SLOTS * sizeof(Dosa_Snapshot) + sizeof(Dosa_Recipe)) <= E2END + 1,
+              "dosa EEPROM records do not fit, lower DOSA_MAX_INSTANCES or SNAPSHOT_SLOTS");
+#endif
+
+// every instance by instance number, for the topic router
+DOSA_GLOBAL Dosa_Cls *dosa_instances[DOSA_MAX_INSTANCES];
+
+DOSA_GLOBAL Dosa_Cls *emergency_stop_instances[DOSA_MAX_INSTANCES];
+DOSA_GLOBAL uint8_t emergency_stop_instance_count = 0;
+
+// one EEPROM, so one writer for every instance's records
+DOSA_GLOBAL Eeprom_Writer_Cls eeprom_writer;
+
+// one controller, one time of day. control/time-of-day to any instance sets it for all of them
+DOSA_GLOBAL Dosa_Clock dosa_clock;
+static_assert(sizeof(Dosa_Snapshot) <= EEPROM_WRITER_SIZE && sizeof(Dosa_Recipe) <= EEPROM_WRITER_SIZE,
+              "a record no longer fits EEPROM_WRITER_SIZE");
+
+enum eeprom_record_tag : uint8_t {
+    eeprom_record_snapshot,
+    eeprom_record_recipe
+};
+
+DOSA_GLOBAL Flow_Sensor *flow_sensors[FLOW_SENSOR_SLOTS];
+DOSA_GLOBAL uint8_t flow_sensor_count = 0;
+
+template <uint8_t slot> static void flow_sensor_isr() {
+    Flow_Sensor *sensor = flow_sensors[slot];
+    sensor->pulses++;
+    if (sensor->target_pulses != 0 && !sensor->target_reached && sensor->pulses >= sensor->target_pulses) {
+        // close on the pulse that completes the volume rather than waiting for main() to notice
+        digitalWrite(sensor->valve_pin, false);
+        *sensor->forced_off |= sensor->valve_bit;
+        sensor->target_reached = true;
+    }
+}
+
+static void (*const flow_sensor_isrs[FLOW_SENSOR_SLOTS])() = {
+    flow_sensor_isr<0>, flow_sensor_isr<1>, flow_sensor_isr<2>,
+    flow_sensor_isr<3>, flow_sensor_isr<4>, flow_sensor_isr<5>,
+};
+
+#define CONTROL_TOPIC_PREFIX_LENGTH 8
+const char control_topic_prefix[] PROGMEM = "control/";
+
+// control topic names, the table below must stay in strcmp order
+const char topic_batch[] PROGMEM = "batch";
+const char topic_closed_loop[] PROGMEM = "closed-loop";
+const char topic_dose_lockout[] PROGMEM = "dose-lockout";
+const char topic_ec_dose[] PROGMEM = "ec-dose";
+const char topic_ec_reading[] PROGMEM = "ec-reading";
+const char topic_ec_setpoint[] PROGMEM = "ec-setpoint";
+const char topic_flow_rate[] PROGMEM = "flow-rate-lpm";
+const char topic_ph_dose[] PROGMEM = "ph-dose";
+const char topic_ph_dose_time[] PROGMEM = "ph-dose-time-s";
+const char topic_ph_reading[] PROGMEM = "ph-reading";
+const char topic_ph_setpoint[] PROGMEM = "ph-setpoint";
+const char topic_ratio_of_A_to_B[] PROGMEM = "ratio-of-A-to-B-%";
+const char topic_recipe[] PROGMEM = "recipe";
+const char topic_run_mixture[] PROGMEM = "run-mixture";
+const char topic_time_of_day[] PROGMEM = "time-of-day";
+#ifdef DOSA_TRACE
+const char topic_trace_dump[] PROGMEM = "trace-dump";
+#endif
+
+struct control_topic_entry {
+    const char *name;
+    control_topic_id id;
+};
+
+const control_topic_entry control_topics[] PROGMEM = {
+    {topic_batch, control_batch},
+    {topic_closed_loop, control_closed_loop},
+    {topic_dose_lockout, control_dose_lockout},
+    {topic_ec_dose, control_ec_dose},
+    {topic_ec_reading, control_ec_reading},
+    {topic_ec_setpoint, control_ec_setpoint},
+    {topic_flow_rate, control_flow_rate},
+    {topic_ph_dose, control_ph_dose},
+    {topic_ph_dose_time, control_ph_dose_time},
+    {topic_ph_reading, control_ph_reading},
+    {topic_ph_setpoint, control_ph_setpoint},
+    {topic_ratio_of_A_to_B, control_ratio_of_A_to_B},
+    {topic_recipe, control_recipe},
+    {topic_run_mixture, control_run_mixture},
+    {topic_time_of_day, control_time_of_day},
+#ifdef DOSA_TRACE
+    {topic_trace_dump, control_trace_dump},
+#endif
+};
+
+#define CONTROL_TOPIC_COUNT (sizeof(control_topics) / sizeof(control_topics[0]))
+
+static uint32_t to_fixed(float value, uint16_t scale) {
+    if (value <= 0) {
+        return 0;
+    }
+    return (uint32_t)(value * scale + 0.5);
+}
+
+static uint32_t round_div(uint64_t numerator, uint32_t denominator) {
+    return (uint32_t)((numerator + denominator / 2) / denominator);
+}
+
+static control_topic_id find_control_topic(const char *name) {
+    // binary search, four flash compares at most for the current table
+    int low = 0;
+    int high = CONTROL_TOPIC_COUNT - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp_P(name, (const char *)pgm_read_ptr(&control_topics[mid].name));
+        if (cmp == 0) {
+            return (control_topic_id)pgm_read_byte(&control_topics[mid].id);
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return control_unknown;
+}
 
 Dosa_Cls::Dosa_Cls() {
 
     this->instance_number = dosa_instance_count;
+    if (dosa_instance_count < DOSA_MAX_INSTANCES) {
+        dosa_instances[dosa_instance_count] = this;
+    }
     dosa_instance_count += 1;
 
     this->lockout_led_pin = 0;
     this->mixture_valve_pin = 0;
     this->mixture_valve_pin_state = false;
     this->ph_valve_pin = 0;
-    this->ph_valve_pin_state = false;
     this->nutrient_A_valve_pin = 0;
-    this->nutrient_A_valve_pin_state = false;
     this->nutrient_B_valve_pin = 0;
-    this->nutrient_B_valve_pin_state = false;
 
     this->emergency_stop_pin = 0;
     this->emergency_stop_state = true;
 
-    this->flow_rate = 0;
-    this->ratio_of_A_to_B = 0;
-    this->prev_ratio_of_A_to_B = 0;
+    this->nutrient_A_flow_sensor_pin = 0;
+    this->nutrient_B_flow_sensor_pin = 0;
+    this->ph_flow_sensor_pin = 0;
+    this->flow_sensor_pulses_per_ml = 0;
+
+    this->eeprom_address = -1;
+    this->snapshot_slot = 0;
+    this->snapshot_check_timer = 0;
+    this->snapshot_write_timer = 0;
+    this->snapshot_writing = false;
+    this->snapshot_sequence = 0;
+    this->snapshot_crc = 0;
+    this->snapshot_flags = 0;
+
+    this->event_log_head = 0;
+    this->event_log_count = 0;
+    this->event_log_sequence = 0;
+    this->event_log_last = 0;
+    this->event_log_flush_timer = 0;
+
+#ifdef DOSA_TRACE
+    this->trace_head = 0;
+    this->trace_count = 0;
+    this->trace_dump_remaining = 0;
+#endif
+
+#ifdef DOSA_PROFILE
+    this->perf_report_stage = perf_stage_count;
+    this->perf_report_timer = 0;
+#endif
+
+    this->recipe_steps = 0;
+    this->recipe_step = -1;
+    this->recipe_timer = 0;
+
+    this->modbus = NULL;
+    this->ec_sensor = -1;
+    this->ph_sensor = -1;
+    this->publish_status_frame = false;
+    this->status_frame_crc = 0;
+
+    this->flow_rate_mlpm = 0;
+    this->ratio_of_A_to_B_centi = 0;
     this->needs_to_dose_ec = false;
     this->needs_to_dose_ph = false;
     this->mixture_state = false;
+    this->mixture_valve_slot = -1;
     this->current_mixture_state = false;
+    this->lockout_led_state = false;
     this->ph_dose_time_s = 0;
-    this->dose_ph_timer = 0;
-
-    this->dose_A_timer = 0;
-    this->dose_A_time_s = 0;
-    this->prev_dose_A_time_s = 0;
-    this->dose_B_timer = 0;
-    this->dose_B_time_s = 0;
-    this->prev_dose_B_time_s = 0;
-    this->ph_dose_state = ph_dose_idle;
-    this->ec_A_dose_state = ec_dose_idle;
-    this->ec_B_dose_state = ec_dose_idle;
+
+    this->channels[dose_channel_A].loop = &this->ec_loop;
+    this->channels[dose_channel_B].loop = &this->ec_loop;
+    this->channels[dose_channel_ph].loop = &this->ph_loop;
+    this->channels[dose_channel_A].request = &this->needs_to_dose_ec;
+    this->channels[dose_channel_A].lockout = safety_timer_lockout_EC;
+    this->channels[dose_channel_A].status = status_nutrient_A_valve;
+    this->channels[dose_channel_B].request = &this->needs_to_dose_ec;
+    this->channels[dose_channel_B].lockout = safety_timer_lockout_EC;
+    this->channels[dose_channel_B].status = status_nutrient_B_valve;
+    this->channels[dose_channel_ph].request = &this->needs_to_dose_ph;
+    this->channels[dose_channel_ph].lockout = safety_timer_lockout_PH;
+    this->channels[dose_channel_ph].status = status_ph_valve;
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        this->channels[i].pin = 0;
+        this->channels[i].duration_ms = 0;
+        this->channels[i].dose_ms = 0;
+        this->channels[i].pulse_ms = 0;
+        this->channels[i].dosed_ms = 0;
+        this->channels[i].pulses = 1;
+        this->channels[i].pulses_done = 0;
+        this->channels[i].timer = 0;
+        this->channels[i].state = dose_idle;
+        this->channels[i].pin_state = false;
+        this->channels[i].valve_slot = -1;
+        this->channels[i].flow_sensor_pin = 0;
+        this->channels[i].flow.valve_pin = 0;
+        this->channels[i].flow.pulses = 0;
+        this->channels[i].flow.target_pulses = 0;
+        this->channels[i].flow.target_reached = false;
+    }
     this->dose_lockout = false;
-    this->prev_lockout_state_control = false;
-    this->prev_lockout_state_ec = false;
-    this->prev_lockout_state_ph = false;
-    this->prev_emergency_stop_state = false;
+    this->current_emergency_stop_state = false;
+    this->lockout_state_control = false;
+    this->lockout_state_ec = false;
+    this->lockout_state_ph = false;
+    this->ec_ratio_changed = false;
+    this->status_dirty = 0;
+    this->status_queue_max_depth = 0;
+    this->status_coalesced = 0;
+    this->status_dropped = 0;
     this->safety_timout_limit_s = 120000;
+
+    this->ec_split_pulses = 1;
+    this->split_rest_ms = 15000;
+    this->split_turn = dose_channel_A;
+    this->split_rest_timer = 0;
+
+    this->closed_loop = false;
+    this->venturi_draw_ml_per_s = 25;
+    this->ec_rise_per_ml = 0;
+    this->ph_drop_per_ml = 0;
+    this->closed_loop_kp = 1.0;
+    this->closed_loop_ki = 0.05;
+    this->closed_loop_interval_ms = 600000;
+    this->settle_min_ms = 60000;
+    this->settled = false;
+    this->reset_loop(this->ec_loop);
+    this->reset_loop(this->ph_loop);
+    this->emergency_stop_latched = false;
+    this->emergency_stop_kill = false;
+    this->emergency_stop_latency_us = 0;
+    this->valves_forced_off = 0;
+    memset(this->emergency_stop_latency_hist, 0, sizeof(this->emergency_stop_latency_hist));
+    this->work_pending = true;
+    this->next_deadline = 0;
+    this->idle_report_timer = 0;
+    this->ticks = 0;
+    this->idle_ticks = 0;
+    this->idle_percent = 0;
     this->lockout_type = none_lockout;
 }
 
@@ -65,6 +323,13 @@ void Dosa_Cls::init() {
     char path[MAX_PATH_LENGTH];
     this->get_commission_path_str(path);
 
+    // left out of the device, so it never runs or claims any pins
+    if (this->instance_number >= DOSA_MAX_INSTANCES) {
+        Serial.print(path);
+        Serial.println(F(": too many dosa instances, raise DOSA_MAX_INSTANCES"));
+        return;
+    }
+
     // led pins
     if (this->lockout_led_pin == 0) {
         Serial.print(path);
@@ -109,6 +374,41 @@ void Dosa_Cls::init() {
     digitalWrite(this->emergency_stop_pin, OFF);
     pinMode(this->emergency_stop_pin, INPUT);
 
+    this->channels[dose_channel_A].pin = this->nutrient_A_valve_pin;
+    this->channels[dose_channel_B].pin = this->nutrient_B_valve_pin;
+    this->channels[dose_channel_ph].pin = this->ph_valve_pin;
+
+    this->channels[dose_channel_A].flow_sensor_pin = this->nutrient_A_flow_sensor_pin;
+    this->channels[dose_channel_B].flow_sensor_pin = this->nutrient_B_flow_sensor_pin;
+    this->channels[dose_channel_ph].flow_sensor_pin = this->ph_flow_sensor_pin;
+
+    this->valves.device = this->device;
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        this->channels[i].valve_slot = this->valves.add(this->channels[i].pin);
+    }
+    this->mixture_valve_slot = this->valves.add(this->mixture_valve_pin);
+
+    // after the valves, the sensor interrupt needs the channel's slot
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        this->attach_flow_sensor(this->channels[i]);
+    }
+
+    // the button pulls the pin low, so pressing it is a falling edge. Pins without an interrupt are only polled
+    if (this->emergency_stop_pin != 0 && digitalPinToInterrupt(this->emergency_stop_pin) != NOT_AN_INTERRUPT &&
+        emergency_stop_instance_count < DOSA_MAX_INSTANCES) {
+        emergency_stop_instances[emergency_stop_instance_count++] = this;
+        attachInterrupt(digitalPinToInterrupt(this->emergency_stop_pin), Dosa_Cls::emergency_stop_isr, FALLING);
+    }
+
+    if (this->restore_snapshot()) {
+        Serial.print(path);
+        Serial.println(F(": control snapshot restored"));
+    }
+    if (this->restore_recipe()) {
+        Serial.print(path);
+        Serial.println(F(": recipe restored, waiting for the time of day"));
+    }
+
     this->device->add_module_to_list(this);
 
     Serial.print(F("Device: "));
@@ -117,12 +417,17 @@ void Dosa_Cls::init() {
 }
 
 void Dosa_Cls::get_commission_path_str(char *path) {
+    // "<mac>/<instance>/dosa/", appended in place so nothing touches the heap
     mac_str(path, this->device->mac_address);
-    strcat(path, "/");
-    strcat(path, String(this->instance_number).c_str());
-    strcat(path, "/");
-    strcat(path, Dosa);
-    strcat(path, "/");
+    char *end = path + strlen(path);
+    *end++ = '/';
+    utoa(this->instance_number, end, 10);
+    end += strlen(end);
+    *end++ = '/';
+    strcpy(end, Dosa);
+    end += strlen(end);
+    *end++ = '/';
+    *end = '\0';
 }
 
 void Dosa_Cls::run_uncommissioned_state() {
@@ -136,84 +441,396 @@ void Dosa_Cls::run_uncommissioned_state() {
     }
 }
 
+Dosa_Cls *Dosa_Cls::route(char *topic) {
+    /*
+        The instance a "<mac>/<instance>/dosa/..." topic is for, NULL if it is not a dosa topic. The instance
+        number is read straight out of the topic and looked up by index, so the cost does not grow with the
+        number of heads.
+    */
+    char *dosa = strstr_P(topic, PSTR("/dosa/"));
+    if (dosa == NULL || dosa == topic) {
+        return NULL;
+    }
+    char *digit = dosa - 1;
+    int instance = 0;
+    int scale = 1;
+    while (digit >= topic && *digit >= '0' && *digit <= '9' && scale <= 1000) {
+        instance += (*digit - '0') * scale;
+        scale *= 10;
+        digit--;
+    }
+    if (scale == 1 || (digit >= topic && *digit != '/') || instance >= DOSA_MAX_INSTANCES ||
+        instance >= dosa_instance_count) {
+        return NULL;
+    }
+    return dosa_instances[instance];
+}
+
+bool Dosa_Cls::dispatch(char *topic, char *payload) {
+    /*
+        Single entry for the bridge, once per message instead of offering it to every head. A topic routed
+        to a head goes to that head alone, anything else, such as commissioning messages, is offered to each
+        head in turn until one takes it.
+    */
+    Dosa_Cls *dosa = Dosa_Cls::route(topic);
+    if (dosa != NULL) {
+        return dosa->process_message(topic, payload);
+    }
+    for (uint8_t i = 0; i < dosa_instance_count && i < DOSA_MAX_INSTANCES; i++) {
+        if (dosa_instances[i]->process_message(topic, payload)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool Dosa_Cls::process_message(char *topic, char *payload) {
     // path and reset messages
     if (this->process_module_messages(topic, payload)) {
         return true;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/flow-rate-lpm")))) {
-        return parse_float_from_string(payload, &this->flow_rate);
+
+    /*
+        Control topics all end in "control/<name>". Find the name after the last '/', look it up in the
+        flash table and only then check the device path, using the "control/<name>" tail of the topic
+        itself so nothing is copied out of flash.
+    */
+    char *name = strrchr(topic, '/');
+    if (name == NULL || name - topic < CONTROL_TOPIC_PREFIX_LENGTH - 1) {
+        return false;
+    }
+    char *control_topic = name - (CONTROL_TOPIC_PREFIX_LENGTH - 1);
+    if (strncmp_P(control_topic, control_topic_prefix, CONTROL_TOPIC_PREFIX_LENGTH) != 0) {
+        return false;
+    }
+
+    // every head sees every message, the others drop it here without touching the topic table
+    if (Dosa_Cls::route(topic) != this) {
+        return false;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/ratio-of-A-to-B-%")))) {
-        return parse_float_from_string(payload, &this->ratio_of_A_to_B);
+
+    control_topic_id id = find_control_topic(name + 1);
+    if (id == control_unknown || !this->topic_main_path_match(topic, control_topic)) {
+        return false;
+    }
+    this->work_pending = true;
+    TRACE(trace_message, id, payload);
+
+    if (id == control_batch) {
+        return this->apply_control_batch(payload);
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/ec-dose")))) {
-        return parse_bool_from_char(payload, &this->needs_to_dose_ec);
+    return this->apply_control(id, payload);
+}
+
+static bool control_value_valid(uint8_t id, char *value) {
+    // the same parse apply_control() will do, without touching any state
+    float f;
+    bool b;
+    long l;
+    switch (id) {
+        case control_flow_rate:
+        case control_ratio_of_A_to_B:
+        case control_ec_setpoint:
+        case control_ec_reading:
+        case control_ph_setpoint:
+        case control_ph_reading:
+            return parse_float_from_string(value, &f);
+        case control_ec_dose:
+        case control_ph_dose:
+        case control_run_mixture:
+        case control_dose_lockout:
+        case control_closed_loop:
+            return parse_bool_from_char(value, &b);
+        case control_ph_dose_time:
+            return parse_ul_from_string(value, &l);
+        default:
+            return false;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/ph-dose")))) {
-        return parse_bool_from_char(payload, &this->needs_to_dose_ph);
+}
+
+bool Dosa_Cls::apply_control_batch(char *payload) {
+    /*
+        control/batch carries "<name>=<value>" pairs for the other control topics separated by ';' or new
+        lines, e.g. "flow-rate-lpm=10;ratio-of-A-to-B-%=40;ec-dose=true". The payload is split in place, the
+        first pass checks every pair and the second applies them in order, so a bad pair rejects the whole
+        batch and main() never sees half of it.
+    */
+    char *end = payload + strlen(payload);
+
+    uint8_t pairs = 0;
+    for (char *key = payload; key < end; ) {
+        char *next = key + strcspn(key, ";\r\n");
+        *next = '\0';
+        if (next > key) {
+            char *value = strchr(key, '=');
+            if (value == NULL) {
+                return false;
+            }
+            *value++ = '\0';
+            if (!control_value_valid(find_control_topic(key), value)) {
+                return false;
+            }
+            pairs++;
+        }
+        key = next + 1;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/run-mixture")))) {
-        return parse_bool_from_char(payload, &this->mixture_state);
+    if (pairs == 0) {
+        return false;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/ph-dose-time-s")))) {
-        return parse_ul_from_string(payload, &this->ph_dose_time_s);
+
+    for (char *key = payload; key < end; ) {
+        if (*key == '\0') {
+            key++;
+            continue;
+        }
+        char *value = key + strlen(key) + 1;
+        this->apply_control(find_control_topic(key), value);
+        key = value + strlen(value) + 1;
     }
-    if (this->topic_main_path_match(topic, FStr(F("control/dose-lockout")))) {
-        this->lockout_type = safety_dose_lockout;
-        return parse_bool_from_char(payload, &this->dose_lockout);
+    return true;
+}
+
+bool Dosa_Cls::apply_control(uint8_t id, char *payload) {
+    float value;
+    switch (id) {
+        case control_flow_rate:
+            if (!parse_float_from_string(payload, &value)) {
+                return false;
+            }
+            this->flow_rate_mlpm = to_fixed(value, 1000);
+            this->ec_ratio_changed = true;
+            return true;
+        case control_ratio_of_A_to_B:
+            if (!parse_float_from_string(payload, &value)) {
+                return false;
+            }
+            value = value > 100 ? 100 : value;
+            this->ratio_of_A_to_B_centi = (uint16_t)to_fixed(value, 100);
+            this->ec_ratio_changed = true;
+            return true;
+        case control_ec_dose:
+            return this->request_dose(this->ec_loop, payload, this->needs_to_dose_ec);
+        case control_ph_dose:
+            return this->request_dose(this->ph_loop, payload, this->needs_to_dose_ph);
+        case control_run_mixture:
+            return parse_bool_from_char(payload, &this->mixture_state);
+        case control_ph_dose_time:
+            if (!parse_ul_from_string(payload, &this->ph_dose_time_s)) {
+                return false;
+            }
+            this->channels[dose_channel_ph].duration_ms = this->ph_dose_time_s > 0 ? this->ph_dose_time_s * 1000 : 0;
+            return true;
+        case control_dose_lockout: {
+            bool lockout;
+            if (!parse_bool_from_char(payload, &lockout)) {
+                return false;
+            }
+            // the broker cannot release a held e-stop, and cannot relabel the lockout it holds
+            if (!lockout && !digitalRead(this->emergency_stop_pin)) {
+                return false;
+            }
+            if (!this->dose_lockout || this->lockout_type != emergency_stop_button) {
+                this->lockout_type = safety_dose_lockout;
+            }
+            this->dose_lockout = lockout;
+            return true;
+        }
+        case control_closed_loop:
+            return parse_bool_from_char(payload, &this->closed_loop);
+        case control_ec_setpoint:
+            return this->set_loop_setpoint(this->ec_loop, payload);
+        case control_ec_reading:
+            return this->set_loop_reading(this->ec_loop, payload);
+        case control_ph_setpoint:
+            return this->set_loop_setpoint(this->ph_loop, payload);
+        case control_ph_reading:
+            return this->set_loop_reading(this->ph_loop, payload);
+        case control_recipe:
+            return this->load_recipe(payload);
+        case control_time_of_day:
+            return this->set_time_of_day(payload);
+#ifdef DOSA_TRACE
+        case control_trace_dump: {
+            bool dump;
+            if (!parse_bool_from_char(payload, &dump)) {
+                return false;
+            }
+            if (dump && this->trace_dump_remaining == 0) {
+                this->trace_dump_remaining = this->trace_count;
+            }
+            return true;
+        }
+#endif
+        default:
+            return false;
     }
-    return false;
 }
 
 void Dosa_Cls::manage_lockout() {
 
+    // nothing releases the lockout while the e-stop is held, whatever cleared dose_lockout
+    if (!this->dose_lockout && !digitalRead(this->emergency_stop_pin)) {
+        this->dose_lockout = true;
+        this->lockout_type = emergency_stop_button;
+    }
+
     if (!this->dose_lockout) {
+        // lockout released, clear the latched states so their status topics go back to false
+        if (this->lockout_led_state) {
+            this->device->set_pin(this->lockout_led_pin, OFF);
+            TRACE(trace_output, this->lockout_led_pin, "0");
+            this->lockout_led_state = false;
+            this->log_event(event_lockout_release, 0, EVENT_NO_CHANNEL, 0);
+        }
+        if (this->lockout_state_control) {
+            this->lockout_state_control = false;
+            this->mark_status(status_doser_lockout);
+        }
+        if (this->lockout_state_ec) {
+            this->lockout_state_ec = false;
+            this->mark_status(status_lockout_ec);
+        }
+        if (this->lockout_state_ph) {
+            this->lockout_state_ph = false;
+            this->mark_status(status_lockout_ph);
+        }
+        // the only place the e-stop kill is lifted, and not while a press is still waiting to be handled
+        if (this->emergency_stop_kill) {
+            noInterrupts();
+            if (!this->emergency_stop_latched) {
+                this->emergency_stop_kill = false;
+                for (uint8_t i = 0; i < dose_channel_count; i++) {
+                    if (this->channels[i].valve_slot >= 0) {
+                        this->valves_forced_off &= ~(1 << this->channels[i].valve_slot);
+                    }
+                }
+            }
+            interrupts();
+        }
         return;
     }
 
-    this->ph_dose_state = ph_dose_end;
-    this->ec_A_dose_state = ec_dose_end;
-    this->ec_B_dose_state = ec_dose_end;
+    // close any open valve and drop requests that are waiting to start
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        if (this->channels[i].state != dose_idle) {
+            this->channels[i].state = dose_end;
+        } else {
+            *this->channels[i].request = false;
+        }
+    }
 
-    this->device->set_pin(this->lockout_led_pin, ON);
+    if (!this->lockout_led_state) {
+        this->device->set_pin(this->lockout_led_pin, ON);
+        TRACE(trace_output, this->lockout_led_pin, "1");
+        this->lockout_led_state = true;
+        this->log_event(event_lockout, this->lockout_type, EVENT_NO_CHANNEL, 0);
+    }
 
-    if (this->lockout_type == safety_dose_lockout) {
+    if (this->lockout_type == safety_dose_lockout && !this->lockout_state_control) {
         this->lockout_state_control = true;
-        this->pub_stat_dose_lockout();
+        this->mark_status(status_doser_lockout);
     }
-    if (this->lockout_type == safety_timer_lockout_PH) {
+    if (this->lockout_type == safety_timer_lockout_PH && !this->lockout_state_ph) {
         this->lockout_state_ph = true;
-        this->pub_stat_dose_lockout_PH();
+        this->mark_status(status_lockout_ph);
     }
-    if (this->lockout_type == safety_timer_lockout_EC) {
+    if (this->lockout_type == safety_timer_lockout_EC && !this->lockout_state_ec) {
         this->lockout_state_ec = true;
-        this->pub_stat_dose_lockout_EC();
-    }
-    if(this->lockout_type == emergency_stop_button){
-        this->emergency_stop_state = true;
-        this->pub_stat_emergency_stop();
+        this->mark_status(status_lockout_ec);
     }
 }
 
 void Dosa_Cls::manage_emergency_stop() {
-    // this gives a status but does not physically do anything
+    /*
+        Polled backstop for the interrupt. Pressing the button locks the doser out, releasing it only clears
+        the button status, dosing stays locked out until control/dose-lockout releases it.
+    */
     this->emergency_stop_state = !digitalRead(this->emergency_stop_pin);
 
     if (this->emergency_stop_state != this->current_emergency_stop_state) {
         this->current_emergency_stop_state = this->emergency_stop_state;
-        this->dose_lockout;
-        this->lockout_type = emergency_stop_button;
+        TRACE(trace_emergency_stop, this->emergency_stop_pin, this->emergency_stop_state ? "1" : "0");
+        if (this->emergency_stop_state) {
+            this->dose_lockout = true;
+            this->lockout_type = emergency_stop_button;
+            this->log_event(event_emergency_stop_pressed, 0, EVENT_NO_CHANNEL, 0);
+        } else {
+            this->log_event(event_emergency_stop_released, 0, EVENT_NO_CHANNEL, 0);
+        }
+        this->mark_status(status_emergency_stop);
+        this->work_pending = true;
+    }
+}
+
+void Dosa_Cls::emergency_stop_isr() {
+    for (uint8_t i = 0; i < emergency_stop_instance_count; i++) {
+        Dosa_Cls *dosa = emergency_stop_instances[i];
+        if (!digitalRead(dosa->emergency_stop_pin)) {
+            dosa->latch_emergency_stop();
+        }
     }
 }
 
+void Dosa_Cls::latch_emergency_stop() {
+    // runs in the ISR, so write the pins directly rather than going through the device
+    unsigned long start = micros();
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        digitalWrite(this->channels[i].pin, OFF);
+        if (this->channels[i].valve_slot >= 0) {
+            this->valves_forced_off |= 1 << this->channels[i].valve_slot;
+        }
+    }
+    this->emergency_stop_latency_us = micros() - start;
+    this->emergency_stop_kill = true;
+    this->emergency_stop_latched = true;
+}
+
+void Dosa_Cls::handle_emergency_stop_latch() {
+    if (!this->emergency_stop_latched) {
+        return;
+    }
+
+    noInterrupts();
+    unsigned long latency_us = this->emergency_stop_latency_us;
+    this->emergency_stop_latched = false;
+    interrupts();
+
+    uint8_t bucket = 0;
+    while (bucket < ESTOP_LATENCY_BUCKETS - 1 && latency_us >= (4UL << bucket)) {
+        bucket++;
+    }
+    if (this->emergency_stop_latency_hist[bucket] < 0xffff) {
+        this->emergency_stop_latency_hist[bucket]++;
+    }
+    this->mark_status(status_emergency_stop_latency);
+
+    // the valves are already shut, bring the channel states and published pin states in line. The press is
+    // taken as seen here so the poll does not log it a second time
+    this->dose_lockout = true;
+    this->lockout_type = emergency_stop_button;
+    if (!this->current_emergency_stop_state) {
+        TRACE(trace_emergency_stop, this->emergency_stop_pin, "1");
+        this->emergency_stop_state = true;
+        this->current_emergency_stop_state = true;
+        this->mark_status(status_emergency_stop);
+        this->log_event(event_emergency_stop_pressed, 0, EVENT_NO_CHANNEL, 0);
+    }
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        this->set_channel_valve(this->channels[i], OFF, cause_emergency_stop);
+    }
+    this->work_pending = true;
+}
+
 bool Dosa_Cls::manage_mixture() {
 
     if (this->mixture_state != this->current_mixture_state) {
         this->current_mixture_state = this->mixture_state;
-        this->device->set_pin(this->mixture_valve_pin, this->current_mixture_state);
+        this->valves.set(this->mixture_valve_slot, this->current_mixture_state);
+        TRACE(trace_output, this->mixture_valve_pin, this->current_mixture_state ? "1" : "0");
         this->mixture_valve_pin_state = this->current_mixture_state;
-        this->pub_stat_mixture();
+        this->mark_status(status_mixture_valve);
+        this->log_event(this->current_mixture_state ? event_valve_open : event_valve_close, cause_request,
+                        EVENT_MIXTURE_CHANNEL, 0);
     }
     return true;
 }
@@ -222,368 +839,1413 @@ bool Dosa_Cls::calculate_ec_ratio() {
     /*
         This funtion takes the dose amount, say 1 litre and divides it with the flowrate, this gives total
         valve on time. This time can then be used to calculate the ratio between A and B.
+
+        Worked in integer ml, ml/min and hundredths of a percent, rounded to the nearest ms. B gets whatever
+        A leaves of the rounded total so the two always add up to the full dose.
     */
-    if (this->flow_rate <= 0) {
-        return;
+    if (this->flow_rate_mlpm == 0 || !this->ec_ratio_changed) {
+        return false;
     }
+    this->ec_ratio_changed = false;
 
-    if (this->ratio_of_A_to_B != this->prev_ratio_of_A_to_B) {
-        if (this->ratio_of_A_to_B >= 100) {
-            this->ratio_of_A_to_B = 100;
-        }
-        if (this->ratio_of_A_to_B <= 0) {
-            this->ratio_of_A_to_B = 0;
-        }
+    uint32_t dose_amount_ml = to_fixed(this->dose_amount_l, 1000);
 
-        this->prev_ratio_of_A_to_B = this->ratio_of_A_to_B;
+    unsigned long total_time_ms = round_div((uint64_t)dose_amount_ml * 60000UL, this->flow_rate_mlpm);
+    unsigned long dose_A_time_ms = round_div((uint64_t)dose_amount_ml * 6UL * this->ratio_of_A_to_B_centi,
+                                             this->flow_rate_mlpm);
+    unsigned long dose_B_time_ms = total_time_ms - dose_A_time_ms;
 
-        float total_valve_on_time = this->dose_amount_l / this->flow_rate;
+    this->set_ec_dose_times(dose_A_time_ms, dose_B_time_ms);
+    return true;
+}
 
-        float A_ratio_as_decimal = this->ratio_of_A_to_B / 100.0;
+void Dosa_Cls::set_ec_dose_times(unsigned long dose_A_time_ms, unsigned long dose_B_time_ms) {
+    if (dose_A_time_ms != this->channels[dose_channel_A].duration_ms) {
+        this->channels[dose_channel_A].duration_ms = dose_A_time_ms;
+        this->mark_status(status_nutrient_A_time);
+    }
+    if (dose_B_time_ms != this->channels[dose_channel_B].duration_ms) {
+        this->channels[dose_channel_B].duration_ms = dose_B_time_ms;
+        this->mark_status(status_nutrient_B_time);
+    }
+}
+
+void Dosa_Cls::reset_loop(Dose_Loop &loop) {
+    loop.setpoint = 0;
+    loop.reading = 0;
+    loop.integral = 0;
+    loop.stepped = false;
+    loop.reading_fresh = false;
+    loop.mixing = false;
+    loop.last_dose = 0;
+    loop.draw_ml_per_s = 0;
+    loop.drift_ml_per_min = 0;
+    loop.draw_p[0] = DRAW_RLS_P0;
+    loop.draw_p[1] = 0;
+    loop.draw_p[2] = DRAW_RLS_P0;
+    loop.pre_dose_reading = 0;
+    loop.pre_dose_time = 0;
+    loop.dose_valve_ms = 0;
+    loop.measuring = false;
+}
 
-        float b_ratio_as_decimal = (100 - this->ratio_of_A_to_B) / 100.0;
+bool Dosa_Cls::set_loop_setpoint(Dose_Loop &loop, char *payload) {
+    float setpoint;
+    if (!parse_float_from_string(payload, &setpoint)) {
+        return false;
+    }
+    this->change_loop_setpoint(loop, setpoint);
+    return true;
+}
 
-        this->dose_A_time_s = ((A_ratio_as_decimal * total_valve_on_time) * 60.0) * 1000;
-        this->dose_B_time_s = ((b_ratio_as_decimal * total_valve_on_time) * 60.0) * 1000;
+void Dosa_Cls::change_loop_setpoint(Dose_Loop &loop, float setpoint) {
+    if (setpoint != loop.setpoint) {
+        // the integral was built up against the old target
+        loop.setpoint = setpoint;
+        loop.integral = 0;
+        loop.stepped = false;
+    }
+}
 
-        this->pub_doseing_times();
+bool Dosa_Cls::set_loop_reading(Dose_Loop &loop, char *payload) {
+    float reading;
+    if (!parse_float_from_string(payload, &reading)) {
+        return false;
+    }
+    this->add_loop_reading(loop, reading);
+    return true;
+}
 
-        return true;
+void Dosa_Cls::add_loop_reading(Dose_Loop &loop, float reading) {
+    loop.filter.add(reading, millis());
+    loop.reading = loop.filter.value;
+    loop.reading_fresh = true;
+    this->work_pending = true;
+
+    // settled once every loop that gets readings has stopped moving
+    bool settled = (this->ec_loop.filter.samples == 0 || this->ec_loop.filter.settled()) &&
+                   (this->ph_loop.filter.samples == 0 || this->ph_loop.filter.settled());
+    if (settled != this->settled) {
+        this->settled = settled;
+        this->mark_status(status_settled);
     }
 }
 
-bool Dosa_Cls::check_ec_A_safety_timer() {
+bool Dosa_Cls::loop_settled(Dose_Loop &loop) {
     /*
-        Check the pin state and start the timer, if the pin does not become false before the safety timer
-        has elappsed, then trigger the safety time out, to stop over dosing.
+        After a dose, act as soon as the filter sees the tank has mixed, but not before the dose can have
+        reached the sensor and not later than the fixed interval.
     */
+    unsigned long elapsed = millis() - loop.last_dose;
+    if (elapsed < this->settle_min_ms) {
+        return false;
+    }
+    return loop.filter.settled() || elapsed >= this->closed_loop_interval_ms;
+}
 
-    if (this->nutrient_A_valve_pin_state) {
-        if (millis() - this->dose_A_timer < this->safety_timout_limit_s) {
-            return;
+unsigned long Dosa_Cls::closed_loop_pulse_ms(Dose_Loop &loop, float error, float change_per_ml) {
+    /*
+        PI on the setpoint error, once per fresh reading after the mixing interval. The feed-forward turns
+        the corrected error into concentrate volume from the tank response per ml, then into valve time from
+        the venturi draw rate. The integral only collects what is left after a dose towards the current
+        setpoint, that residual is the feed-forward model being off, the step itself is not integrated.
+    */
+    if (loop.stepped) {
+        loop.integral += error;
+        if (loop.integral < 0) {
+            // no dose can undo an overshoot, so there is nothing to gain from a negative integral
+            loop.integral = 0;
         }
-        this->lockout_state_ec = true;
-        this->dose_lockout = true;
-        this->lockout_type = safety_timer_lockout_EC;
-        this->needs_to_dose_ec = false;
     }
-    return true;
+
+    float correction = this->closed_loop_kp * error + this->closed_loop_ki * loop.integral;
+    float pulse_ms = correction / change_per_ml / this->loop_draw_rate(loop) * 1000;
+    if (pulse_ms < CLOSED_LOOP_MIN_PULSE_MS) {
+        return 0;
+    }
+
+    loop.stepped = true;
+    float max_pulse_ms = this->safety_timout_limit_s * CLOSED_LOOP_MAX_PULSE_PERCENT / 100;
+    return pulse_ms < max_pulse_ms ? (unsigned long)pulse_ms : (unsigned long)max_pulse_ms;
 }
 
-bool Dosa_Cls::check_ec_B_safety_timer() {
+float Dosa_Cls::loop_draw_rate(Dose_Loop &loop) {
+    return loop.draw_ml_per_s > 0 ? loop.draw_ml_per_s : this->venturi_draw_ml_per_s;
+}
 
-    if (this->nutrient_B_valve_pin_state) {
-        if (millis() - this->dose_B_timer < this->safety_timout_limit_s) {
-            return;
+void Dosa_Cls::update_draw_rate(Dose_Loop &loop, float change, float change_per_ml) {
+    /*
+        Recursive least squares on ml = draw * valve seconds + drift * minutes, the ml taken from the settled
+        change in the reading over the dose and the tank response per ml. The drift term soaks up what the
+        plants take out (or the tank gains) while a dose mixes, without it the small doses that only hold a
+        setpoint teach a draw rate far too low. A and B always dose together into one EC response, so the EC
+        loop learns their shared draw rather than one per valve.
+    */
+    loop.measuring = false;
+    if (loop.dose_valve_ms < CLOSED_LOOP_MIN_PULSE_MS || change_per_ml <= 0) {
+        return;
+    }
+    float x0 = loop.dose_valve_ms / 1000.0;
+    float x1 = (millis() - loop.pre_dose_time) / 60000.0;
+    float y = change / change_per_ml;
+    float theta = this->loop_draw_rate(loop);
+    float *p = loop.draw_p;
+
+    // gain = P x / (forget + x' P x)
+    float px0 = p[0] * x0 + p[1] * x1;
+    float px1 = p[1] * x0 + p[2] * x1;
+    float denominator = DRAW_RLS_FORGET + x0 * px0 + x1 * px1;
+    float k0 = px0 / denominator;
+    float k1 = px1 / denominator;
+
+    float error = y - theta * x0 - loop.drift_ml_per_min * x1;
+    theta += k0 * error;
+    loop.drift_ml_per_min += k1 * error;
+
+    // P = (P - gain x' P) / forget, capped so a long run of similar doses cannot wind it up
+    p[0] = (p[0] - k0 * px0) / DRAW_RLS_FORGET;
+    p[1] = (p[1] - k0 * px1) / DRAW_RLS_FORGET;
+    p[2] = (p[2] - k1 * px1) / DRAW_RLS_FORGET;
+    float largest = p[0] > p[2] ? p[0] : p[2];
+    if (largest > DRAW_RLS_P0) {
+        // scaled as a whole, capping one diagonal alone could leave P no longer positive definite
+        for (uint8_t i = 0; i < 3; i++) {
+            p[i] *= DRAW_RLS_P0 / largest;
         }
-        this->lockout_state_ec = true;
-        this->dose_lockout = true;
-        this->lockout_type = safety_timer_lockout_EC;
-        this->needs_to_dose_ec = false;
     }
+
+    // a sensor fault or a tank top up mid dose must not teach it something absurd
+    float low = this->venturi_draw_ml_per_s * DRAW_RLS_MIN_FACTOR;
+    float high = this->venturi_draw_ml_per_s * DRAW_RLS_MAX_FACTOR;
+    loop.draw_ml_per_s = theta < low ? low : theta > high ? high : theta;
+    this->mark_status(status_draw_rates);
+}
+
+bool Dosa_Cls::request_dose(Dose_Loop &loop, char *payload, bool &request) {
+    /*
+        An ec-dose or ph-dose from outside is refused while the loop's readings are still settling from the
+        last dose, the tank has not shown yet what that dose did. A loop that gets no readings is never held.
+    */
+    bool dose;
+    if (!parse_bool_from_char(payload, &dose)) {
+        return false;
+    }
+    if (dose && loop.mixing && loop.filter.samples > 0 && !this->loop_settled(loop)) {
+        return false;
+    }
+    request = dose;
     return true;
 }
 
-bool Dosa_Cls::check_ph_safety_timer() {
+bool Dosa_Cls::closed_loop_ready(Dose_Loop &loop) {
+    if (!loop.reading_fresh) {
+        return false;
+    }
+    if (loop.mixing && !this->loop_settled(loop)) {
+        return false;
+    }
+    loop.reading_fresh = false;
+    loop.mixing = false;
+    return true;
+}
 
-    if (this->ph_valve_pin_state) {
-        if (millis() - this->dose_ph_timer < this->safety_timout_limit_s) {
-            return;
+int Dosa_Cls::snapshot_address(uint8_t slot) {
+    return this->eeprom_address + (this->instance_number * SNAPSHOT_SLOTS + slot) * sizeof(Dosa_Snapshot);
+}
+
+void Dosa_Cls::build_snapshot(Dosa_Snapshot &image) {
+    memset(&image, 0, sizeof(image));
+    image.version = SNAPSHOT_VERSION;
+    image.flags = this->dose_lockout | this->closed_loop << 1;
+    image.flow_rate_mlpm = this->flow_rate_mlpm;
+    image.ratio_of_A_to_B_centi = this->ratio_of_A_to_B_centi;
+    image.lockout_type = this->lockout_type;
+    image.ph_dose_time_s = this->ph_dose_time_s;
+    image.ec_setpoint = this->ec_loop.setpoint;
+    image.ph_setpoint = this->ph_loop.setpoint;
+    image.ec_draw_ml_per_s = this->ec_loop.draw_ml_per_s;
+    image.ec_drift_ml_per_min = this->ec_loop.drift_ml_per_min;
+    memcpy(image.ec_draw_p, this->ec_loop.draw_p, sizeof(image.ec_draw_p));
+    image.ph_draw_ml_per_s = this->ph_loop.draw_ml_per_s;
+    image.ph_drift_ml_per_min = this->ph_loop.drift_ml_per_min;
+    memcpy(image.ph_draw_p, this->ph_loop.draw_p, sizeof(image.ph_draw_p));
+}
+
+bool Dosa_Cls::restore_snapshot() {
+    /*
+        Called from init(), before any retained message, so the control values are back within
+        milliseconds of boot. Whatever the broker replays afterwards simply overrides them.
+    */
+    if (this->eeprom_address < 0) {
+        return false;
+    }
+
+    int8_t newest = -1;
+    Dosa_Snapshot image;
+    for (uint8_t slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        EEPROM.get(this->snapshot_address(slot), image);
+        if (image.version != SNAPSHOT_VERSION ||
+            image.crc != Modbus_Master_Cls::crc16((uint8_t *)&image, offsetof(Dosa_Snapshot, crc))) {
+            continue;
         }
-        this->lockout_state_ph = true;
-        this->dose_lockout = true;
-        this->lockout_type = safety_timer_lockout_PH;
-        this->needs_to_dose_ph = false;
+        // sequence numbers wrap, so compare the difference rather than the values
+        if (newest < 0 || (int16_t)(image.sequence - this->snapshot_sequence) > 0) {
+            newest = slot;
+            this->snapshot_sequence = image.sequence;
+        }
+    }
+    if (newest < 0) {
+        return false;
     }
+
+    EEPROM.get(this->snapshot_address(newest), image);
+    this->snapshot_slot = newest;
+    this->snapshot_crc = image.crc;
+    this->snapshot_flags = image.flags;
+    this->flow_rate_mlpm = image.flow_rate_mlpm;
+    this->ratio_of_A_to_B_centi = image.ratio_of_A_to_B_centi;
+    this->ph_dose_time_s = image.ph_dose_time_s;
+    this->channels[dose_channel_ph].duration_ms = this->ph_dose_time_s > 0 ? this->ph_dose_time_s * 1000 : 0;
+    this->dose_lockout = image.flags & 1;
+    this->closed_loop = image.flags & 2;
+    this->lockout_type = (lockout_state)image.lockout_type;
+    this->ec_loop.setpoint = image.ec_setpoint;
+    this->ph_loop.setpoint = image.ph_setpoint;
+    this->ec_loop.draw_ml_per_s = image.ec_draw_ml_per_s;
+    this->ec_loop.drift_ml_per_min = image.ec_drift_ml_per_min;
+    memcpy(this->ec_loop.draw_p, image.ec_draw_p, sizeof(this->ec_loop.draw_p));
+    this->ph_loop.draw_ml_per_s = image.ph_draw_ml_per_s;
+    this->ph_loop.drift_ml_per_min = image.ph_drift_ml_per_min;
+    memcpy(this->ph_loop.draw_p, image.ph_draw_p, sizeof(this->ph_loop.draw_p));
+    this->ec_ratio_changed = true;
     return true;
 }
 
-bool Dosa_Cls::dose_nutrient_a() {
+void Dosa_Cls::save_snapshot() {
+    /*
+        Looked at once a second and only written when something changed. A lockout change goes out at the
+        next look, anything else at most every SNAPSHOT_WRITE_MS. The EEPROM writer spreads the write over
+        the following ticks, into the slot after the newest, so a reset mid write still finds the last one.
+    */
+    if (this->eeprom_address < 0 || this->snapshot_writing ||
+        millis() - this->snapshot_check_timer < SNAPSHOT_CHECK_MS) {
+        return;
+    }
+    this->snapshot_check_timer = millis();
 
-    if (this->ratio_of_A_to_B < 1) {
+    // only the CRC of the last image is kept, the same values under the same sequence give the same CRC
+    Dosa_Snapshot image;
+    this->build_snapshot(image);
+    image.sequence = this->snapshot_sequence;
+    if (Modbus_Master_Cls::crc16((uint8_t *)&image, offsetof(Dosa_Snapshot, crc)) == this->snapshot_crc) {
+        return;
+    }
+    bool lockout_changed = (image.flags & 1) != (this->snapshot_flags & 1);
+    if (!lockout_changed && millis() - this->snapshot_write_timer < SNAPSHOT_WRITE_MS) {
         return;
     }
 
-    switch (this->ec_A_dose_state) {
+    image.sequence = this->snapshot_sequence + 1;
+    image.crc = Modbus_Master_Cls::crc16((uint8_t *)&image, offsetof(Dosa_Snapshot, crc));
+    uint8_t slot = (this->snapshot_slot + 1) % SNAPSHOT_SLOTS;
+    // another record is going in, try again at the next look
+    if (!eeprom_writer.start(this, eeprom_record_snapshot, this->snapshot_address(slot), &image, sizeof(image),
+                             Dosa_Cls::eeprom_write_done, false)) {
+        return;
+    }
+    this->snapshot_sequence = image.sequence;
+    this->snapshot_crc = image.crc;
+    this->snapshot_flags = image.flags;
+    this->snapshot_slot = slot;
+    this->snapshot_writing = true;
+    this->snapshot_write_timer = millis();
+}
 
-        case ec_dose_idle:
-            if (!this->needs_to_dose_ec) {
-                return;
-            }
-            if (!this->dose_lockout) {
-                this->ec_A_dose_state = ec_dose_start;
-            }
-            break;
+void Dosa_Cls::eeprom_write_done(void *owner, uint8_t tag, bool written) {
+    ((Dosa_Cls *)owner)->eeprom_written(tag, written);
+}
 
-        case ec_dose_start:
-            this->device->set_pin(this->nutrient_A_valve_pin, ON); // make functions for speaerte pins
-            this->nutrient_A_valve_pin_state = true;
-            this->dose_A_timer = millis();
-            this->pub_stat_nutrient_a();
-            this->ec_A_dose_state = ec_dose_run_timer;
-            break;
+void Dosa_Cls::eeprom_written(uint8_t tag, bool written) {
+    if (tag == eeprom_record_snapshot) {
+        this->snapshot_writing = false;
+        if (!written) {
+            // dropped for a recipe, the slot is left invalid. A CRC no image can match has the next look
+            // write it again
+            this->snapshot_crc = ~this->snapshot_crc;
+            this->snapshot_write_timer = millis() - SNAPSHOT_WRITE_MS;
+        }
+    } else if (tag == eeprom_record_recipe && written) {
+        // the new recipe is whole in EEPROM, run from it
+        this->recipe_steps = EEPROM.read(this->recipe_address() + offsetof(Dosa_Recipe, steps));
+        this->recipe_step = -1;
+        this->recipe_timer = millis() - RECIPE_CHECK_MS;
+        this->mark_status(status_recipe_step);
+    }
+}
+
+int Dosa_Cls::recipe_address() {
+    // after the snapshots of every instance
+    return this->eeprom_address + DOSA_MAX_INSTANCES * SNAPSHOT_SLOTS * sizeof(Dosa_Snapshot) +
+           this->instance_number * sizeof(Dosa_Recipe);
+}
 
-        case ec_dose_run_timer:
-            if (millis() - this->dose_A_timer <= this->dose_A_time_s) {
-                return;
+static char *next_field(char **pos, char separator) {
+    // the field at *pos, terminated in place, *pos moves past it. NULL once the string is used up
+    if (*pos == NULL) {
+        return NULL;
+    }
+    char *field = *pos;
+    char *end = strchr(field, separator);
+    if (end == NULL) {
+        *pos = NULL;
+    } else {
+        *end = '\0';
+        *pos = end + 1;
+    }
+    return field;
+}
+
+static bool parse_time_of_day(char *text, unsigned long *seconds) {
+    // "HH:MM" or "HH:MM:SS"
+    unsigned long parts[3] = {0, 0, 0};
+    uint8_t count = 0;
+    char *pos = text;
+    while (true) {
+        if (count == 3 || *pos < '0' || *pos > '9') {
+            return false;
+        }
+        while (*pos >= '0' && *pos <= '9') {
+            parts[count] = parts[count] * 10 + (*pos++ - '0');
+            if (parts[count] > 59) {
+                return false;
             }
-            this->dose_A_timer = millis();
-            this->ec_A_dose_state = ec_dose_end;
+        }
+        count++;
+        if (*pos != ':') {
             break;
+        }
+        pos++;
+    }
+    if (*pos != '\0' || count < 2 || parts[0] > 23) {
+        return false;
+    }
+    *seconds = parts[0] * 3600 + parts[1] * 60 + parts[2];
+    return true;
+}
 
-        case ec_dose_end:
-            this->device->set_pin(this->nutrient_A_valve_pin, OFF);
-            this->nutrient_A_valve_pin_state = false;
-            this->needs_to_dose_ec = false;
-            this->pub_stat_nutrient_a();
-            this->ec_A_dose_state = ec_dose_idle;
-            break;
-        default:
-            this->ec_A_dose_state = ec_dose_idle;
-            break;
+bool Dosa_Cls::load_recipe(char *payload) {
+    /*
+        Parsed in place into a scratch copy, the running recipe is only replaced once every step checks
+        out. An empty payload clears the recipe. Steps are only kept in EEPROM, so without it there is no
+        recipe.
+    */
+    if (this->eeprom_address < 0) {
+        return false;
     }
+    Dosa_Recipe loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    loaded.version = RECIPE_VERSION;
+
+    char *steps = *payload != '\0' ? payload : NULL;
+    char *text;
+    while ((text = next_field(&steps, ';')) != NULL) {
+        if (*text == '\0') {
+            continue;
+        }
+        if (loaded.steps == RECIPE_STEPS) {
+            return false;
+        }
+        Recipe_Step &step = loaded.step[loaded.steps];
+        char *fields = text;
+        char *start = next_field(&fields, ',');
+        char *ec = next_field(&fields, ',');
+        char *ph = next_field(&fields, ',');
+        char *ratio = next_field(&fields, ',');
+        char *ph_dose_time = next_field(&fields, ',');
+        if (ph_dose_time == NULL || fields != NULL) {
+            return false;
+        }
+
+        unsigned long seconds;
+        float ratio_percent;
+        long ph_dose_time_s;
+        if (!parse_time_of_day(start, &seconds) || !parse_float_from_string(ec, &step.ec_setpoint) ||
+            !parse_float_from_string(ph, &step.ph_setpoint) || !parse_float_from_string(ratio, &ratio_percent) ||
+            !parse_ul_from_string(ph_dose_time, &ph_dose_time_s) || ph_dose_time_s < 0 || ph_dose_time_s > 0xffff) {
+            return false;
+        }
+        step.start_minute = seconds / 60;
+        step.ratio_of_A_to_B_centi = (uint16_t)to_fixed(ratio_percent > 100 ? 100 : ratio_percent, 100);
+        step.ph_dose_time_s = ph_dose_time_s;
+        if (loaded.steps > 0 && step.start_minute <= loaded.step[loaded.steps - 1].start_minute) {
+            return false;
+        }
+        loaded.steps++;
+    }
+
+    loaded.crc = Modbus_Master_Cls::crc16((uint8_t *)&loaded, offsetof(Dosa_Recipe, crc));
+    this->save_recipe(loaded);
+
+    // looked at again straight away
+    this->recipe_step = -1;
+    this->recipe_timer = millis() - RECIPE_CHECK_MS;
+    this->mark_status(status_recipe_step);
     return true;
 }
 
-bool Dosa_Cls::dose_nutrient_b() {
+void Dosa_Cls::save_recipe(Dosa_Recipe &recipe) {
+    /*
+        Handed to the EEPROM writer rather than put() in one go, which held the loop for ~3.3 ms a changed
+        byte. The broker replays the retained recipe on every connect, so the copy already stored is looked
+        for first and an unchanged recipe writes nothing. Nothing runs while the record is half written, it
+        is picked up again in eeprom_written(). A reset mid write leaves a record that fails its CRC, the
+        retained message puts it back.
+    */
+    int address = this->recipe_address();
+    if (!eeprom_writer.owned_by(this, eeprom_record_recipe)) {
+        uint16_t i = 0;
+        while (i < sizeof(recipe) && EEPROM.read(address + i) == ((uint8_t *)&recipe)[i]) {
+            i++;
+        }
+        if (i == sizeof(recipe)) {
+            this->recipe_steps = recipe.steps;
+            return;
+        }
+    }
+    this->recipe_steps = 0;
+    // a snapshot in flight is dropped and written again by its owner, another instance's recipe has no
+    // second chance so it is finished first
+    if (eeprom_writer.writing(eeprom_record_recipe) && !eeprom_writer.owned_by(this, eeprom_record_recipe)) {
+        eeprom_writer.finish();
+    }
+    eeprom_writer.start(this, eeprom_record_recipe, address, &recipe, sizeof(recipe), Dosa_Cls::eeprom_write_done,
+                        true);
+}
 
-    if (this->ratio_of_A_to_B < 1) {
-        return;
+bool Dosa_Cls::restore_recipe() {
+    if (this->eeprom_address < 0) {
+        return false;
+    }
+    Dosa_Recipe stored;
+    EEPROM.get(this->recipe_address(), stored);
+    if (stored.version != RECIPE_VERSION || stored.steps == 0 || stored.steps > RECIPE_STEPS ||
+        stored.crc != Modbus_Master_Cls::crc16((uint8_t *)&stored, offsetof(Dosa_Recipe, crc))) {
+        return false;
     }
+    this->recipe_steps = stored.steps;
+    return true;
+}
 
-    switch (this->ec_B_dose_state) {
+void Dosa_Cls::read_recipe_step(uint8_t index, Recipe_Step &step) {
+    EEPROM.get(this->recipe_address() + offsetof(Dosa_Recipe, step) + index * sizeof(Recipe_Step), step);
+}
 
-        case ec_dose_idle:
-            if (!this->needs_to_dose_ec) {
-                return;
-            }
-            if (!this->dose_lockout) {
-                this->ec_B_dose_state = ec_dose_start;
-            }
-            break;
+bool Dosa_Cls::set_time_of_day(char *payload) {
+    unsigned long seconds;
+    if (!parse_time_of_day(payload, &seconds)) {
+        return false;
+    }
+    dosa_clock.day_ms = seconds * 1000;
+    dosa_clock.millis = millis();
+    dosa_clock.synced = true;
+    this->recipe_timer = millis() - RECIPE_CHECK_MS;
+    return true;
+}
 
-        case ec_dose_start:
-            this->device->set_pin(this->nutrient_B_valve_pin, ON);
-            this->nutrient_B_valve_pin_state = true;
-            this->dose_B_timer = millis();
-            this->pub_stat_nutrient_b();
-            this->ec_B_dose_state = ec_dose_run_timer;
-            break;
+unsigned long Dosa_Cls::time_of_day_ms() {
+    /*
+        Moved on from the last sync on every call rather than worked out from it, so the millis() difference
+        stays short and both the day and the millis() rollover wrap cleanly however long the doser runs
+        without a sync.
+    */
+    unsigned long now = millis();
+    dosa_clock.day_ms = (dosa_clock.day_ms + (now - dosa_clock.millis)) % DAY_MS;
+    dosa_clock.millis = now;
+    return dosa_clock.day_ms;
+}
 
-        case ec_dose_run_timer:
-            if (millis() - this->dose_B_timer <= this->dose_B_time_s) {
-                return;
-            }
-            this->dose_B_timer = millis();
-            this->ec_B_dose_state = ec_dose_end;
+void Dosa_Cls::run_recipe() {
+    if (this->recipe_steps == 0 || !dosa_clock.synced || millis() - this->recipe_timer < RECIPE_CHECK_MS) {
+        return;
+    }
+    this->recipe_timer = millis();
+
+    // the last step that has started today, or yesterday's last step before the first one starts
+    uint16_t minute = this->time_of_day_ms() / 60000;
+    Recipe_Step entry;
+    int8_t step = this->recipe_steps - 1;
+    for (uint8_t i = 0; i < this->recipe_steps; i++) {
+        this->read_recipe_step(i, entry);
+        if (entry.start_minute > minute) {
             break;
+        }
+        step = i;
+    }
+    if (step == this->recipe_step) {
+        return;
+    }
+    this->recipe_step = step;
+    this->read_recipe_step(step, entry);
+    this->apply_recipe_step(entry);
+    this->mark_status(status_recipe_step);
+}
 
-        case ec_dose_end:
-            this->device->set_pin(this->nutrient_B_valve_pin, OFF);
-            this->nutrient_B_valve_pin_state = false;
-            this->needs_to_dose_ec = false;
-            this->pub_stat_nutrient_b();
-            this->ec_B_dose_state = ec_dose_idle;
-            break;
+void Dosa_Cls::apply_recipe_step(Recipe_Step &step) {
+    // the same changes the control topics make, so the values publish and snapshot as if they had arrived
+    this->change_loop_setpoint(this->ec_loop, step.ec_setpoint);
+    this->change_loop_setpoint(this->ph_loop, step.ph_setpoint);
+    this->ratio_of_A_to_B_centi = step.ratio_of_A_to_B_centi;
+    this->ec_ratio_changed = true;
+    this->ph_dose_time_s = step.ph_dose_time_s;
+    this->channels[dose_channel_ph].duration_ms = this->ph_dose_time_s * 1000;
+    this->mark_status(status_control);
+    this->work_pending = true;
+}
 
-        default:
-            this->ec_B_dose_state = ec_dose_idle;
-            break;
+void Dosa_Cls::read_modbus_sensors() {
+    /*
+        Readings straight off the bus, the same as a control/ec-reading or ph-reading message but without the broker round
+        trip. The bus keeps running every tick, a fresh value wakes the dose logic.
+    */
+    this->modbus->main();
+
+    float value;
+    if (this->modbus->read_sensor(this->ec_sensor, &value)) {
+        this->add_loop_reading(this->ec_loop, value);
+    }
+    if (this->modbus->read_sensor(this->ph_sensor, &value)) {
+        this->add_loop_reading(this->ph_loop, value);
+    }
+}
+
+void Dosa_Cls::run_closed_loop() {
+    if (!this->closed_loop || this->dose_lockout) {
+        return;
+    }
+
+    bool ec_idle = this->channels[dose_channel_A].state == dose_idle &&
+                   this->channels[dose_channel_B].state == dose_idle && !this->needs_to_dose_ec;
+    if (ec_idle && this->ec_rise_per_ml > 0 && this->closed_loop_ready(this->ec_loop)) {
+        if (this->ec_loop.measuring) {
+            this->update_draw_rate(this->ec_loop, this->ec_loop.reading - this->ec_loop.pre_dose_reading,
+                                   this->ec_rise_per_ml);
+        }
+        float error = this->ec_loop.setpoint - this->ec_loop.reading;
+        unsigned long total_ms = this->closed_loop_pulse_ms(this->ec_loop, error, this->ec_rise_per_ml);
+        if (total_ms > 0) {
+            unsigned long dose_A_time_ms = round_div((uint64_t)total_ms * this->ratio_of_A_to_B_centi, 10000);
+            this->set_ec_dose_times(dose_A_time_ms, total_ms - dose_A_time_ms);
+            this->needs_to_dose_ec = true;
+        }
+    }
+
+    bool ph_idle = this->channels[dose_channel_ph].state == dose_idle && !this->needs_to_dose_ph;
+    if (ph_idle && this->ph_drop_per_ml > 0 && this->closed_loop_ready(this->ph_loop)) {
+        if (this->ph_loop.measuring) {
+            this->update_draw_rate(this->ph_loop, this->ph_loop.pre_dose_reading - this->ph_loop.reading,
+                                   this->ph_drop_per_ml);
+        }
+        // pH down, so a reading above the setpoint is the positive error
+        float error = this->ph_loop.reading - this->ph_loop.setpoint;
+        unsigned long pulse_ms = this->closed_loop_pulse_ms(this->ph_loop, error, this->ph_drop_per_ml);
+        if (pulse_ms > 0) {
+            this->channels[dose_channel_ph].duration_ms = pulse_ms;
+            this->needs_to_dose_ph = true;
+        }
+    }
+}
+
+bool Dosa_Cls::check_safety_timer(Dose_Channel &channel) {
+    /*
+        Check the pin state and start the timer, if the pin does not become false before the safety timer
+        has elappsed, then trigger the safety time out, to stop over dosing.
+    */
+
+    if (channel.pin_state) {
+        if (millis() - channel.timer < (unsigned long)this->safety_timout_limit_s) {
+            return false;
+        }
+        this->dose_lockout = true;
+        this->lockout_type = channel.lockout;
+        *channel.request = false;
     }
     return true;
 }
 
-bool Dosa_Cls::dose_ph() {
+void Dosa_Cls::set_channel_valve(Dose_Channel &channel, bool state, event_cause cause) {
+    // an e-stop press holds every valve shut until the lockout is released, even one main() has not seen yet
+    if (state && (this->emergency_stop_kill || this->emergency_stop_latched)) {
+        return;
+    }
+    this->valves.set(channel.valve_slot, state);
+    if (channel.pin_state != state) {
+        channel.pin_state = state;
+        TRACE(trace_output, channel.pin, state ? "1" : "0");
+        this->mark_status(channel.status);
+        this->log_event(state ? event_valve_open : event_valve_close, cause, &channel - this->channels,
+                        state ? 0 : millis() - channel.timer);
+        if (!state) {
+            channel.loop->dose_valve_ms += millis() - channel.timer;
+        }
+    }
+    if (state) {
+        if (!channel.loop->mixing) {
+            // the draw rate estimator measures the dose from the reading before its first valve opened
+            channel.loop->measuring = channel.loop->filter.samples > 0;
+            channel.loop->pre_dose_reading = channel.loop->reading;
+            channel.loop->pre_dose_time = millis();
+            channel.loop->dose_valve_ms = 0;
+        }
+        if (this->volumetric(channel)) {
+            // the valve closes on volume, its open time says nothing about the draw rate
+            channel.loop->measuring = false;
+        }
 
-    wdt_reset();
+        // whoever asked for the dose, the readings now have to settle again
+        channel.loop->mixing = true;
+        channel.loop->last_dose = millis();
+        channel.loop->filter.restart();
+        if (this->settled) {
+            this->settled = false;
+            this->mark_status(status_settled);
+        }
+    }
+}
 
-    if (this->ph_dose_time_s < 1) {
+void Dosa_Cls::attach_flow_sensor(Dose_Channel &channel) {
+    channel.flow.valve_pin = channel.pin;
+    channel.flow.forced_off = &this->valves_forced_off;
+    channel.flow.valve_bit = channel.valve_slot >= 0 ? 1 << channel.valve_slot : 0;
+    if (channel.flow_sensor_pin == 0) {
+        return;
+    }
+    if (digitalPinToInterrupt(channel.flow_sensor_pin) == NOT_AN_INTERRUPT || flow_sensor_count >= FLOW_SENSOR_SLOTS) {
+        Serial.print(channel.flow_sensor_pin);
+        Serial.println(F(": flow sensor pin has no free interrupt, channel stays time based"));
+        channel.flow_sensor_pin = 0;
         return;
     }
+    pinMode(channel.flow_sensor_pin, INPUT_PULLUP);
+    flow_sensors[flow_sensor_count] = &channel.flow;
+    attachInterrupt(digitalPinToInterrupt(channel.flow_sensor_pin), flow_sensor_isrs[flow_sensor_count], FALLING);
+    flow_sensor_count++;
+}
 
-    switch (ph_dose_state) {
+bool Dosa_Cls::volumetric(Dose_Channel &channel) {
+    return channel.flow_sensor_pin != 0 && this->flow_sensor_pulses_per_ml > 0;
+}
 
-        case ph_dose_idle:
-            if (!this->needs_to_dose_ph) {
-                return;
-            }
-            if (!this->dose_lockout) {
-                this->ph_dose_state = ph_dose_start;
+void Dosa_Cls::start_flow_count(Dose_Channel &channel) {
+    /*
+        The dose window is the volume the venturi would draw at the loop's draw rate, counted in sensor pulses
+        instead of time. That is the rate the closed loop sized the pulse with, so the volume counted is the
+        volume it asked for. The valve timer keeps running for the safety timeout.
+    */
+    float pulses_per_ms = this->loop_draw_rate(*channel.loop) * this->flow_sensor_pulses_per_ml / 1000;
+    // taken off the running total, so the sub-pulses of a split dose add up to exactly the whole dose
+    uint32_t target_pulses = (uint32_t)((channel.dosed_ms + channel.pulse_ms) * pulses_per_ms + 0.5) -
+                             (uint32_t)(channel.dosed_ms * pulses_per_ms + 0.5);
+
+    noInterrupts();
+    channel.flow.pulses = 0;
+    channel.flow.target_pulses = target_pulses > 0 ? target_pulses : 1;
+    channel.flow.target_reached = false;
+    if (!this->emergency_stop_kill) {
+        this->valves_forced_off &= ~channel.flow.valve_bit;
+    }
+    interrupts();
+}
+
+void Dosa_Cls::stop_flow_count(Dose_Channel &channel) {
+    noInterrupts();
+    channel.flow.target_pulses = 0;
+    interrupts();
+}
+
+bool Dosa_Cls::split_channel(Dose_Channel &channel) {
+    return this->ec_split_pulses > 1 && channel.loop == &this->ec_loop;
+}
+
+void Dosa_Cls::start_dose(Dose_Channel &channel) {
+    // the time is fixed for the whole dose, so a new ratio mid dose cannot unbalance the sub-pulses
+    channel.dose_ms = channel.duration_ms;
+    channel.dosed_ms = 0;
+    channel.pulses_done = 0;
+    channel.pulses = 1;
+    if (this->split_channel(channel)) {
+        // no sub-pulse shorter than the closed loop would bother with
+        unsigned long most = channel.dose_ms / CLOSED_LOOP_MIN_PULSE_MS;
+        channel.pulses = most < this->ec_split_pulses ? (most > 0 ? most : 1) : this->ec_split_pulses;
+    }
+    this->next_pulse(channel);
+}
+
+bool Dosa_Cls::next_pulse(Dose_Channel &channel) {
+    /*
+        Sub-pulse k of n runs from dose_ms * k / n to dose_ms * (k + 1) / n, in integer ms, so the pulses of
+        each channel always add up to its whole dose and the A:B split is untouched. False once all are done.
+    */
+    if (channel.pulses_done >= channel.pulses) {
+        return false;
+    }
+    unsigned long end = (uint64_t)channel.dose_ms * (channel.pulses_done + 1) / channel.pulses;
+    channel.pulse_ms = end - channel.dosed_ms;
+    return true;
+}
+
+bool Dosa_Cls::run_dose_channel(Dose_Channel &channel) {
+
+    switch (channel.state) {
+
+        case dose_idle:
+            if (!*channel.request || channel.duration_ms == 0 || this->dose_lockout) {
+                return false;
             }
+            this->start_dose(channel);
+            channel.state = this->split_channel(channel) ? dose_rest : dose_start;
             break;
 
-        case ph_dose_start:
-            this->device->set_pin(this->ph_valve_pin, ON);
-            this->ph_valve_pin_state = true;
-            this->dose_ph_timer = millis();
-            this->pub_stat_ph();
-            this->ph_dose_state = ph_dose_run_timer;
+        case dose_rest: {
+            /*
+                Split doses take turns, A and B never open together and every sub-pulse gets the rest
+                before it, apart from the first one.
+            */
+            uint8_t id = &channel - this->channels;
+            if (this->split_turn != id || millis() - this->split_rest_timer < this->split_rest_ms) {
+                return false;
+            }
+            channel.state = dose_start;
             break;
+        }
 
-        case ph_dose_run_timer:
-            if (millis() - this->dose_ph_timer < DOSE_TIME_MS) {
-                return;
+        case dose_start:
+            if (this->volumetric(channel)) {
+                this->start_flow_count(channel);
             }
-            this->dose_ph_timer = millis();
-            this->ph_dose_state = ph_dose_end;
+            this->set_channel_valve(channel, ON, cause_request);
+            channel.timer = millis();
+            channel.state = dose_run_timer;
             break;
 
-        case ph_dose_end:
-            this->device->set_pin(this->ph_valve_pin, OFF);
-            this->ph_valve_pin_state = false;
-            this->needs_to_dose_ph = false;
-            this->pub_stat_ph();
-            this->ph_dose_state = ph_dose_idle;
+        case dose_run_timer:
+            if (this->volumetric(channel)) {
+                if (!channel.flow.target_reached) {
+                    return false;
+                }
+            } else if (millis() - channel.timer < channel.pulse_ms) {
+                return false;
+            }
+            // closed on this pass rather than the next tick, or every sub-pulse of a split dose runs a tick
+            // long and the total drifts with the pulse count
+            channel.state = dose_end;
+            // fall through
+        case dose_end:
+            this->stop_flow_count(channel);
+            this->set_channel_valve(channel, OFF, this->dose_lockout ? cause_lockout :
+                                    this->volumetric(channel) ? cause_volume : cause_timer);
+            channel.dosed_ms += channel.pulse_ms;
+            channel.pulses_done++;
+            if (this->split_channel(channel)) {
+                // over to the other EC channel if it still has sub-pulses to give
+                Dose_Channel &other = this->channels[&channel == &this->channels[dose_channel_A] ?
+                                                     dose_channel_B : dose_channel_A];
+                if (other.state == dose_rest) {
+                    this->split_turn = &other - this->channels;
+                }
+                this->split_rest_timer = millis();
+            }
+            if (!this->dose_lockout && this->next_pulse(channel)) {
+                channel.state = dose_rest;
+                break;
+            }
+            *channel.request = false;
+            channel.state = dose_idle;
             break;
 
         default:
-            this->ph_dose_state = ph_dose_idle;
+            channel.state = dose_idle;
             break;
     }
     return true;
 }
 
+bool Dosa_Cls::run_dose_channels() {
+    wdt_reset();
+
+    // a new split EC dose starts with A, or B if A has nothing to give, and without a rest
+    if (this->ec_split_pulses > 1 && this->needs_to_dose_ec &&
+        this->channels[dose_channel_A].state == dose_idle && this->channels[dose_channel_B].state == dose_idle) {
+        this->split_turn = this->channels[dose_channel_A].duration_ms > 0 ? dose_channel_A : dose_channel_B;
+        this->split_rest_timer = millis() - this->split_rest_ms;
+    }
+
+    // true if any channel changed state and needs another pass straight away
+    bool moved = false;
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        PERF_TIME(perf_dose_A + i, moved |= this->run_dose_channel(this->channels[i]));
+    }
+    return moved;
+}
+
+void Dosa_Cls::schedule_next_deadline() {
+    /*
+        The next time main() has to look at the dose logic without a message arriving: the earliest dose
+        end or safety timeout of a running channel, or the idle recheck if nothing is running.
+    */
+    unsigned long now = millis();
+    unsigned long wait = IDLE_RECHECK_MS;
+
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        Dose_Channel &channel = this->channels[i];
+        if (channel.state == dose_rest && this->split_turn == i) {
+            unsigned long rested = now - this->split_rest_timer;
+            unsigned long remaining = rested < this->split_rest_ms ? this->split_rest_ms - rested : 0;
+            if (remaining < wait) {
+                wait = remaining;
+            }
+            continue;
+        }
+        if (channel.state != dose_run_timer) {
+            continue;
+        }
+        unsigned long elapsed = now - channel.timer;
+        unsigned long end = (unsigned long)this->safety_timout_limit_s;
+        if (this->volumetric(channel)) {
+            end = elapsed + FLOW_SENSOR_POLL_MS < end ? elapsed + FLOW_SENSOR_POLL_MS : end;
+        } else if (channel.pulse_ms < end) {
+            end = channel.pulse_ms;
+        }
+        unsigned long remaining = elapsed < end ? end - elapsed : 0;
+        if (remaining < wait) {
+            wait = remaining;
+        }
+    }
+    this->next_deadline = now + wait;
+}
+
+void Dosa_Cls::report_idle_time() {
+    if (millis() - this->idle_report_timer < IDLE_REPORT_MS || this->ticks == 0) {
+        return;
+    }
+    this->idle_percent = (uint8_t)((this->idle_ticks * 100) / this->ticks);
+    this->mark_status(status_idle_percent);
+    this->mark_status(status_publish_queue);
+    this->ticks = 0;
+    this->idle_ticks = 0;
+    this->idle_report_timer = millis();
+}
+
 void Dosa_Cls::publish_status() {
+    /*
+        Queue everything, the dirty status drain sends it over the next ticks in priority order, so a
+        reconnect never holds a lockout or e-stop state behind the hardware and config topics. The
+        informational topics the frame does not carry were dropped while the broker was away, so they are
+        queued again in either mode.
+    */
+    this->mark_status(status_emergency_stop_latency);
+    this->mark_status(status_idle_percent);
+    this->mark_status(status_recipe_step);
+    this->mark_status(status_publish_queue);
 
-    wdt_reset();
-    char val[MAX_PATH_LENGTH];
+    if (this->publish_status_frame) {
+        this->mark_status(status_frame);
+        return;
+    }
 
-    mac_str(val, this->device->mac_address);
-    this->publish_main(FStr(F("mac-address")), val, true, 1);
-    strcpy(val, Dosa);
-    this->publish_main(FStr(F("firmware-type")), val, true, 1);
+    this->mark_status(status_identity);
+    this->mark_status(status_hardware);
+    this->mark_status(status_control);
+    this->mark_status(status_ph_valve);
+    this->mark_status(status_mixture_valve);
+    this->mark_status(status_nutrient_A_time);
+    this->mark_status(status_nutrient_B_time);
+    this->mark_status(status_nutrient_A_valve);
+    this->mark_status(status_nutrient_B_valve);
+    this->mark_status(status_lockout_summary);
+    this->mark_status(status_draw_rates);
+    this->mark_status(status_emergency_stop);
+}
+
+static uint8_t *frame_put(uint8_t *pos, uint32_t value, uint8_t size) {
+    for (uint8_t i = 0; i < size; i++) {
+        *pos++ = (uint8_t)(value >> (8 * i));
+    }
+    return pos;
+}
 
-    // Hardware endpoints
-    this->publish_main(FStr(F("hardware/ph-pin")), this->ph_valve_pin, true, 1);
-    this->publish_main(FStr(F("hardware/mixture-pin")), this->mixture_valve_pin, true, 1);
-    this->publish_main(FStr(F("hardware/nutrient-a-pin")), this->nutrient_A_valve_pin, true, 1);
-    this->publish_main(FStr(F("hardware/nutrient-b-pin")), this->nutrient_B_valve_pin, true, 1);
-    this->publish_main(FStr(F("hardware/emergency-stop-pin")), this->emergency_stop_pin, true, 1);
+static uint8_t *frame_put_float(uint8_t *pos, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return frame_put(pos, bits, 4);
+}
 
-    // control status end points
-    this->publish_main(FStr(F("control/flow-rate-lpm")), this->flow_rate, true, 1);
-    this->publish_main(FStr(F("control/ratio-of-A-to-B-%")), this->ratio_of_A_to_B, true, 1);
-    this->publish_main(FStr(F("control/ec-dose")), this->needs_to_dose_ec, false, 1);
-    this->publish_main(FStr(F("control/ph-dose")), this->needs_to_dose_ph, false, 1);
-    this->publish_main(FStr(F("control/run-mixture")), this->mixture_state, false, 1);
-    this->publish_main(FStr(F("control/ph-dose-time-s")), this->ph_dose_time_s, true, 1);
-    this->publish_main(FStr(F("control/dose-lockout")), this->dose_lockout, true, 1);
+static void hex_encode(char *hex, const uint8_t *data, uint8_t length) {
+    // hex keeps binary payloads printable for brokers and clients that expect strings
+    for (uint8_t i = 0; i < length; i++) {
+        hex[i * 2] = "0123456789abcdef"[data[i] >> 4];
+        hex[i * 2 + 1] = "0123456789abcdef"[data[i] & 0x0f];
+    }
+    hex[length * 2] = '\0';
+}
 
-    // status-tres")), this->dose_amount_l, true, 1);
-    this->publish_main(FStr(F("status/ph-pin")), this->ph_valve_pin_state, false, 1);
-    this->publish_main(FStr(F("status/mixture-pin")), this->mixture_valve_pin_state, false, 1);
-    this->publish_main(FStr(F("status/nutrient-A-dosing-time-s")), this->dose_A_time_s, false, 1);
-    this->publish_main(FStr(F("status/nutrient-B-dosing-time-s")), this->dose_B_time_s, false, 1);
-    this->publish_main(FStr(F("status/nutrient-A-valve-pin")), this->nutrient_A_valve_pin_state, false, 1);
-    this->publish_main(FStr(F("status/nutrient-B-valve-pin")), this->nutrient_B_valve_pin_state, false, 1);
-    this->publish_main(FStr(F("status/doser-lockout")), this->dose_lockout, false, 1);
-    this->publish_main(FStr(F("status/safety-timer-lockout-ph")), this->dose_lockout, false, 1);
-    this->publish_main(FStr(F("status/safety-timer-lockout-ec")), this->dose_lockout, false, 1);
-    this->publish_main(FStr(F("status/emergency-stop-button")), this->emergency_stop_state, false, 1);
+void Dosa_Cls::build_status_frame(uint8_t *frame) {
+    uint8_t *pos = frame;
+
+    *pos++ = STATUS_FRAME_VERSION;
+    *pos++ = this->needs_to_dose_ec | this->needs_to_dose_ph << 1 | this->mixture_state << 2 | this->dose_lockout << 3;
+    *pos++ = this->channels[dose_channel_ph].pin_state | this->mixture_valve_pin_state << 1 |
+             this->channels[dose_channel_A].pin_state << 2 | this->channels[dose_channel_B].pin_state << 3;
+    *pos++ = this->lockout_state_control | this->lockout_state_ec << 1 |
+             this->lockout_state_ph << 2 | this->emergency_stop_state << 3;
+    *pos++ = this->lockout_type;
+
+    pos = frame_put(pos, (uint16_t)this->ph_valve_pin, 2);
+    pos = frame_put(pos, (uint16_t)this->mixture_valve_pin, 2);
+    pos = frame_put(pos, (uint16_t)this->nutrient_A_valve_pin, 2);
+    pos = frame_put(pos, (uint16_t)this->nutrient_B_valve_pin, 2);
+    pos = frame_put(pos, (uint16_t)this->emergency_stop_pin, 2);
+
+    pos = frame_put_float(pos, this->flow_rate_mlpm / 1000.0f);
+    pos = frame_put_float(pos, this->ratio_of_A_to_B_centi / 100.0f);
+    pos = frame_put(pos, (uint32_t)this->ph_dose_time_s, 4);
+    pos = frame_put_float(pos, this->channels[dose_channel_A].duration_ms);
+    pos = frame_put_float(pos, this->channels[dose_channel_B].duration_ms);
+    frame_put_float(pos, this->dose_amount_l);
 }
 
-void Dosa_Cls::pub_stat_ph() {
-    if (this->ph_valve_pin_state != this->prev_ph_valve_pin_state) {
-        this->publish_main(FStr(F("status/ph-pin")), this->ph_valve_pin_state, false, 1);
-        this->prev_ph_valve_pin_state = this->ph_valve_pin_state;
+void Dosa_Cls::check_status_frame() {
+    /*
+        The frame is retained, so it has to follow the fields it carries, not only go out on connect. Run
+        after the dose logic, where every one of them changes, and queued again when it comes out different.
+    */
+    if (!this->publish_status_frame) {
+        return;
     }
+    uint8_t frame[STATUS_FRAME_LENGTH];
+    this->build_status_frame(frame);
+    if (Modbus_Master_Cls::crc16(frame, STATUS_FRAME_LENGTH) != this->status_frame_crc) {
+        this->mark_status(status_frame);
+    }
+}
+
+void Dosa_Cls::pub_status_frame() {
+    uint8_t frame[STATUS_FRAME_LENGTH];
+    this->build_status_frame(frame);
+    this->status_frame_crc = Modbus_Master_Cls::crc16(frame, STATUS_FRAME_LENGTH);
+
+    char hex[STATUS_FRAME_LENGTH * 2 + 1];
+    hex_encode(hex, frame, STATUS_FRAME_LENGTH);
+    this->publish_main(FStr(F("status/frame")), hex, true, 1);
 }
 
-void Dosa_Cls::pub_stat_mixture() {
-    if (this->mixture_valve_pin_state != this->prev_mixture_valve_pin_state) {
-        this->publish_main(FStr(F("status/mixture-pin")), this->mixture_valve_pin_state, false, 1);
-        this->prev_mixture_valve_pin_state = this->mixture_valve_pin_state;
+void Dosa_Cls::log_event(event_type type, uint8_t cause, uint8_t channel, uint32_t duration_ms) {
+    unsigned long now = millis();
+    unsigned long delta_ds = (now - this->event_log_last) / 100;
+
+    if (this->event_log_count == EVENT_LOG_SIZE) {
+        // full, drop the oldest record
+        this->event_log_head = (this->event_log_head + 1) % EVENT_LOG_SIZE;
+        this->event_log_sequence++;
+        this->event_log_count--;
     }
+
+    Dose_Event &event = this->event_log[(this->event_log_head + this->event_log_count) % EVENT_LOG_SIZE];
+    event.delta_ds = delta_ds < 0xffff ? delta_ds : 0xffff;
+    event.type_cause = type | cause << 4;
+    event.channel = channel;
+    event.duration_ms = duration_ms;
+
+    this->event_log_count++;
+    this->event_log_last = now;
 }
 
-void Dosa_Cls::pub_doseing_times() {
+void Dosa_Cls::publish_event_log() {
+    /*
+        One batch per call. A batch goes out as soon as EVENT_BATCH records are waiting, a smaller one once
+        EVENT_FLUSH_MS has passed since the last publish. Nothing is drained while the broker is away.
+    */
+    if (this->event_log_count == 0 || !this->device->mqtt_connected) {
+        return;
+    }
+    if (this->event_log_count < EVENT_BATCH && millis() - this->event_log_flush_timer < EVENT_FLUSH_MS) {
+        return;
+    }
+
+    uint8_t count = this->event_log_count < EVENT_BATCH ? this->event_log_count : EVENT_BATCH;
 
-    if (this->dose_A_time_s != this->prev_dose_A_time_s) {
-        this->publish_main(FStr(F("status/nutrient-A-dosing-time-s")), this->dose_A_time_s, false, 1);
-        this->prev_dose_A_time_s = this->dose_A_time_s;
+    // age of the last record in the batch, the newest record's age plus the deltas of the ones after it
+    unsigned long age_ms = millis() - this->event_log_last;
+    for (uint8_t i = count; i < this->event_log_count; i++) {
+        age_ms += this->event_log[(this->event_log_head + i) % EVENT_LOG_SIZE].delta_ds * 100UL;
     }
 
-    if (this->dose_B_time_s != this->prev_dose_B_time_s) {
-        this->publish_main(FStr(F("status/nutrient-B-dosing-time-s")), this->dose_B_time_s, false, 1);
-        this->prev_dose_B_time_s = this->dose_B_time_s;
+    uint8_t batch[EVENT_HEADER_LENGTH + EVENT_BATCH * EVENT_RECORD_LENGTH];
+    uint8_t *pos = batch;
+    *pos++ = EVENT_LOG_VERSION;
+    pos = frame_put(pos, this->event_log_sequence, 4);
+    *pos++ = count;
+    pos = frame_put(pos, age_ms, 4);
+    for (uint8_t i = 0; i < count; i++) {
+        Dose_Event &event = this->event_log[(this->event_log_head + i) % EVENT_LOG_SIZE];
+        pos = frame_put(pos, event.delta_ds, 2);
+        *pos++ = event.type_cause;
+        *pos++ = event.channel;
+        pos = frame_put(pos, event.duration_ms, 4);
     }
+
+    char hex[sizeof(batch) * 2 + 1];
+    hex_encode(hex, batch, pos - batch);
+    this->publish_main(FStr(F("status/events")), hex, false, 1);
+
+    this->event_log_head = (this->event_log_head + count) % EVENT_LOG_SIZE;
+    this->event_log_count -= count;
+    this->event_log_sequence += count;
+    this->event_log_flush_timer = millis();
 }
 
-void Dosa_Cls::pub_stat_nutrient_a() {
-    if (this->nutrient_A_valve_pin_state != this->prev_nutrient_A_valve_pin_state) {
-        this->publish_main(FStr(F("status/nutrient-A-valve-pin")), this->nutrient_A_valve_pin_state, false, 1);
-        this->prev_nutrient_A_valve_pin_state = this->nutrient_A_valve_pin_state;
+#ifdef DOSA_PROFILE
+const char perf_name_tick[] PROGMEM = "perf/tick";
+const char perf_name_check_error_state[] PROGMEM = "perf/check-error-state";
+const char perf_name_calculate_ec_ratio[] PROGMEM = "perf/calculate-ec-ratio";
+const char perf_name_closed_loop[] PROGMEM = "perf/closed-loop";
+const char perf_name_dose_A[] PROGMEM = "perf/dose-A";
+const char perf_name_dose_B[] PROGMEM = "perf/dose-B";
+const char perf_name_dose_ph[] PROGMEM = "perf/dose-ph";
+const char perf_name_manage_mixture[] PROGMEM = "perf/manage-mixture";
+const char perf_name_modbus[] PROGMEM = "perf/modbus";
+const char perf_name_publish_status[] PROGMEM = "perf/publish-status";
+const char perf_name_publish_dirty_status[] PROGMEM = "perf/publish-dirty-status";
+
+// in perf_stage order
+const char *const perf_names[perf_stage_count] PROGMEM = {
+    perf_name_tick, perf_name_check_error_state, perf_name_calculate_ec_ratio, perf_name_closed_loop,
+    perf_name_dose_A, perf_name_dose_B, perf_name_dose_ph, perf_name_manage_mixture, perf_name_modbus,
+    perf_name_publish_status, perf_name_publish_dirty_status,
+};
+
+void Dosa_Cls::report_perf() {
+    /*
+        Every PERF_REPORT_MS the stages are published one per tick, each stage starts a fresh window once it
+        has gone out. Nothing is reset while the broker is away, the window just gets longer.
+    */
+    if (this->perf_report_stage >= perf_stage_count) {
+        if (millis() - this->perf_report_timer < PERF_REPORT_MS) {
+            return;
+        }
+        this->perf_report_timer = millis();
+        this->perf_report_stage = 0;
+    }
+    if (!this->device->mqtt_connected) {
+        return;
     }
+
+    char topic[32];
+    char line[PERF_LINE_LENGTH];
+    strcpy_P(topic, (const char *)pgm_read_ptr(&perf_names[this->perf_report_stage]));
+    this->perf.format(this->perf_report_stage, line);
+    this->publish_main(topic, line, false, 0);
+    this->perf.reset(this->perf_report_stage);
+    this->perf_report_stage++;
 }
+#endif
 
-void Dosa_Cls::pub_stat_nutrient_b() {
-    if (this->nutrient_B_valve_pin_state != this->prev_nutrient_B_valve_pin_state) {
-        this->publish_main(FStr(F("status/nutrient-B-valve-pin")), this->nutrient_B_valve_pin_state, false, 1);
-        this->prev_nutrient_B_valve_pin_state = this->nutrient_B_valve_pin_state;
+#ifdef DOSA_TRACE
+void Dosa_Cls::trace(trace_kind kind, uint8_t id, const char *value) {
+    if (this->trace_dump_remaining > 0) {
+        return;
     }
+    if (this->trace_count == TRACE_SIZE) {
+        this->trace_head = (this->trace_head + 1) % TRACE_SIZE;
+        this->trace_count--;
+    }
+    Trace_Record &record = this->trace_log[(this->trace_head + this->trace_count) % TRACE_SIZE];
+    record.ms = millis();
+    record.kind = kind;
+    record.id = id;
+    strncpy(record.value, value, TRACE_VALUE_LENGTH - 1);
+    record.value[TRACE_VALUE_LENGTH - 1] = '\0';
+    this->trace_count++;
 }
 
-void Dosa_Cls::pub_stat_emergency_stop() {
-    if (this->emergency_stop_state != this->prev_emergency_stop_state) {
-        this->publish_main(FStr(F("status/emergency-stop-button")), this->emergency_stop_state, false, 1);
-        this->prev_emergency_stop_state = this->emergency_stop_state;
+void Dosa_Cls::dump_trace() {
+    if (this->trace_dump_remaining == 0 || !this->device->mqtt_connected) {
+        return;
     }
+    uint8_t index = (this->trace_head + this->trace_count - this->trace_dump_remaining) % TRACE_SIZE;
+    Trace_Record &record = this->trace_log[index];
+
+    // "<millis>,message,<longest topic name>,<value>" at most
+    char line[56];
+    char *pos = line;
+    ultoa(record.ms, pos, 10);
+    pos += strlen(pos);
+    *pos++ = ',';
+    if (record.kind == trace_message) {
+        strcpy_P(pos, PSTR("message,"));
+        pos += strlen(pos);
+        // the topic name, so a trace still reads right after the id order changes
+        for (uint8_t i = 0; i < CONTROL_TOPIC_COUNT; i++) {
+            if (pgm_read_byte(&control_topics[i].id) == record.id) {
+                strcpy_P(pos, (const char *)pgm_read_ptr(&control_topics[i].name));
+                break;
+            }
+        }
+    } else {
+        strcpy_P(pos, record.kind == trace_emergency_stop ? PSTR("emergency-stop,") : PSTR("output,"));
+        pos += strlen(pos);
+        utoa(record.id, pos, 10);
+    }
+    pos += strlen(pos);
+    *pos++ = ',';
+    strcpy(pos, record.value);
+
+    Serial.println(line);
+    this->publish_main(FStr(F("status/trace")), line, false, 1);
+    this->trace_dump_remaining--;
 }
+#endif
 
-void Dosa_Cls::pub_stat_dose_lockout() {
-    if(this->lockout_state_control != this->prev_lockout_state_control){
-        this->publish_main(FStr(F("status/doser-lockout")), this->dose_lockout, false, 1);
-        this->prev_lockout_state_control = this->lockout_state_control;
+void Dosa_Cls::mark_status(status_bit bit) {
+    uint32_t mask = (uint32_t)1 << bit;
+    if (this->status_dirty & mask) {
+        this->status_coalesced++;
     }
+    this->status_dirty |= mask;
 }
 
-void Dosa_Cls::pub_stat_dose_lockout_EC() {
-    if(this->lockout_state_ec != this->prev_lockout_state_ec){
-        this->publish_main(FStr(F("status/doser-safety-timer-lockout-ec")), this->dose_lockout, false, 1);
-        this->prev_lockout_state_ec = this->lockout_state_ec;
+uint8_t Dosa_Cls::status_queue_depth() {
+    uint8_t depth = 0;
+    for (uint32_t dirty = this->status_dirty; dirty; dirty &= dirty - 1) {
+        depth++;
+    }
+    return depth;
+}
+
+uint8_t Dosa_Cls::publish_dirty_status(uint8_t budget) {
+    /*
+        Publish the flagged status topics in bit order, safety first, and return the budget left over. Safety
+        bits always go out, the other classes stop once the budget is spent.
+    */
+    uint8_t depth = this->status_queue_depth();
+    if (depth > this->status_queue_max_depth) {
+        this->status_queue_max_depth = depth;
+    }
+
+    if (!this->device->mqtt_connected) {
+        uint32_t informational = this->status_dirty & ~(((uint32_t)1 << STATUS_INFORMATIONAL_FIRST) - 1);
+        if (informational) {
+            this->status_dirty &= ~informational;
+            for (; informational; informational &= informational - 1) {
+                this->status_dropped++;
+            }
+        }
+        return budget;
+    }
+
+    for (uint8_t bit = 0; bit < status_bit_count && this->status_dirty; bit++) {
+        if (bit >= STATUS_ACTUATION_FIRST && budget == 0) {
+            break;
+        }
+        uint32_t mask = (uint32_t)1 << bit;
+        if (this->status_dirty & mask) {
+            this->status_dirty &= ~mask;
+            uint8_t sent = this->pub_status_bit(bit);
+            if (bit >= STATUS_ACTUATION_FIRST) {
+                budget = sent < budget ? budget - sent : 0;
+            }
+        }
     }
+    return budget;
 }
 
-void Dosa_Cls::pub_stat_dose_lockout_PH() {
-    if(this->lockout_state_ph != this->prev_lockout_state_ph){
-        this->publish_main(FStr(F("status/doser-safety-timer-lockout-ph")), this->dose_lockout, false, 1);
-        this->prev_lockout_state_ph = this->lockout_state_ph;
+uint8_t Dosa_Cls::pub_status_bit(uint8_t bit) {
+    // returns the number of messages sent, groups send more than one
+    switch (bit) {
+        case status_doser_lockout:
+            this->publish_main(FStr(F("status/doser-lockout")), this->lockout_state_control, false, 1);
+            break;
+        case status_lockout_ec:
+            this->publish_main(FStr(F("status/doser-safety-timer-lockout-ec")), this->lockout_state_ec, false, 1);
+            break;
+        case status_lockout_ph:
+            this->publish_main(FStr(F("status/doser-safety-timer-lockout-ph")), this->lockout_state_ph, false, 1);
+            break;
+        case status_emergency_stop:
+            this->publish_main(FStr(F("status/emergency-stop-button")), this->emergency_stop_state, false, 1);
+            break;
+        case status_lockout_summary:
+            this->publish_main(FStr(F("status/doser-lockout")), this->dose_lockout, false, 1);
+            this->publish_main(FStr(F("status/safety-timer-lockout-ph")), this->dose_lockout, false, 1);
+            this->publish_main(FStr(F("status/safety-timer-lockout-ec")), this->dose_lockout, false, 1);
+            return 3;
+        case status_emergency_stop_latency: {
+            // comma separated bucket counts, see ESTOP_LATENCY_BUCKETS
+            char hist[ESTOP_LATENCY_BUCKETS * 6 + 1];
+            char *pos = hist;
+            for (uint8_t i = 0; i < ESTOP_LATENCY_BUCKETS; i++) {
+                if (i > 0) {
+                    *pos++ = ',';
+                }
+                utoa(this->emergency_stop_latency_hist[i], pos, 10);
+                pos += strlen(pos);
+            }
+            this->publish_main(FStr(F("status/emergency-stop-latency-us")), hist, false, 1);
+            break;
+        }
+        case status_nutrient_A_valve:
+            this->publish_main(FStr(F("status/nutrient-A-valve-pin")), this->channels[dose_channel_A].pin_state, false, 1);
+            break;
+        case status_nutrient_B_valve:
+            this->publish_main(FStr(F("status/nutrient-B-valve-pin")), this->channels[dose_channel_B].pin_state, false, 1);
+            break;
+        case status_ph_valve:
+            this->publish_main(FStr(F("status/ph-pin")), this->channels[dose_channel_ph].pin_state, false, 1);
+            break;
+        case status_mixture_valve:
+            this->publish_main(FStr(F("status/mixture-pin")), this->mixture_valve_pin_state, false, 1);
+            break;
+        case status_nutrient_A_time:
+            this->publish_main(FStr(F("status/nutrient-A-dosing-time-s")), (float)this->channels[dose_channel_A].duration_ms, false, 1);
+            break;
+        case status_nutrient_B_time:
+            this->publish_main(FStr(F("status/nutrient-B-dosing-time-s")), (float)this->channels[dose_channel_B].duration_ms, false, 1);
+            break;
+        case status_control:
+            this->publish_main(FStr(F("control/flow-rate-lpm")), this->flow_rate_mlpm / 1000.0f, true, 1);
+            this->publish_main(FStr(F("control/ratio-of-A-to-B-%")), this->ratio_of_A_to_B_centi / 100.0f, true, 1);
+            this->publish_main(FStr(F("control/ec-dose")), this->needs_to_dose_ec, false, 1);
+            this->publish_main(FStr(F("control/ph-dose")), this->needs_to_dose_ph, false, 1);
+            this->publish_main(FStr(F("control/run-mixture")), this->mixture_state, false, 1);
+            this->publish_main(FStr(F("control/ph-dose-time-s")), this->ph_dose_time_s, true, 1);
+            this->publish_main(FStr(F("control/dose-lockout")), this->dose_lockout, true, 1);
+            return 7;
+        case status_frame:
+            this->pub_status_frame();
+            break;
+        case status_settled:
+            this->publish_main(FStr(F("status/settled")), this->settled, false, 1);
+            break;
+        case status_identity: {
+            char val[MAX_PATH_LENGTH];
+            mac_str(val, this->device->mac_address);
+            this->publish_main(FStr(F("mac-address")), val, true, 1);
+            strcpy(val, Dosa);
+            this->publish_main(FStr(F("firmware-type")), val, true, 1);
+            return 2;
+        }
+        case status_hardware:
+            this->publish_main(FStr(F("hardware/ph-pin")), this->ph_valve_pin, true, 1);
+            this->publish_main(FStr(F("hardware/mixture-pin")), this->mixture_valve_pin, true, 1);
+            this->publish_main(FStr(F("hardware/nutrient-a-pin")), this->nutrient_A_valve_pin, true, 1);
+            this->publish_main(FStr(F("hardware/nutrient-b-pin")), this->nutrient_B_valve_pin, true, 1);
+            this->publish_main(FStr(F("hardware/emergency-stop-pin")), this->emergency_stop_pin, true, 1);
+            return 5;
+        case status_idle_percent:
+            this->publish_main(FStr(F("status/idle-percent")), (short)this->idle_percent, false, 1);
+            break;
+        case status_draw_rates:
+            this->publish_main(FStr(F("status/ec-draw-ml-per-s")), this->loop_draw_rate(this->ec_loop), false, 1);
+            this->publish_main(FStr(F("status/ph-draw-ml-per-s")), this->loop_draw_rate(this->ph_loop), false, 1);
+            return 2;
+        case status_recipe_step:
+            this->publish_main(FStr(F("status/recipe-step")), (short)this->recipe_step, false, 1);
+            break;
+        case status_publish_queue: {
+            // depth, max depth, coalesced, dropped
+            char stats[4 * 11 + 1];
+            unsigned long fields[4] = {this->status_queue_depth(), this->status_queue_max_depth,
+                                       this->status_coalesced, this->status_dropped};
+            char *pos = stats;
+            for (uint8_t i = 0; i < 4; i++) {
+                if (i > 0) {
+                    *pos++ = ',';
+                }
+                ultoa(fields[i], pos, 10);
+                pos += strlen(pos);
+            }
+            this->publish_main(FStr(F("status/publish-queue")), stats, false, 1);
+            break;
+        }
     }
+    return 1;
 }
 
+
 void Dosa_Cls::check_error_state() {
-    this->check_ec_A_safety_timer();
-    this->check_ec_B_safety_timer();
-    this->check_ph_safety_timer();
+    for (uint8_t i = 0; i < dose_channel_count; i++) {
+        this->check_safety_timer(this->channels[i]);
+    }
     this->manage_lockout();
-    this->manage_emergency_stop();
 }
 
 void Dosa_Cls::main() {
 
     wdt_reset();
 
+    this->handle_emergency_stop_latch();
+
     if (!this->commissioned) {
         this->run_uncommissioned_state();
         return;
     }
 
+#ifdef DOSA_PROFILE
+    unsigned long tick_start = PERF_CLOCK();
+#endif
+
     if (this->device->new_control_connection) {
-        this->publish_status();
+        PERF_TIME(perf_publish_status, this->publish_status());
     }
 
     if (this->device->new_mqtt_connection || this->newly_commissioned) {
         this->commissioning_subscribe();
         this->control_subscribe();
-        this->publish_status();
+        PERF_TIME(perf_publish_status, this->publish_status());
 
         this->newly_commissioned = false;
     }
 
-    this->check_error_state();
-    this->calculate_ec_ratio();
-    this->dose_nutrient_a();
-    this->dose_nutrient_b();
-    this->dose_ph();
-    this->manage_mixture();
+    // the e-stop is an input, not a deadline, so it is still polled every tick
+    this->manage_emergency_stop();
+
+    if (this->modbus != NULL) {
+        PERF_TIME(perf_modbus, this->read_modbus_sensors());
+    }
+
+    this->run_recipe();
+
+    this->ticks++;
+    if (this->work_pending || (long)(millis() - this->next_deadline) >= 0) {
+        this->work_pending = false;
+        PERF_TIME(perf_check_error_state, this->check_error_state());
+        PERF_TIME(perf_calculate_ec_ratio, this->calculate_ec_ratio());
+        PERF_TIME(perf_closed_loop, this->run_closed_loop());
+        if (this->run_dose_channels()) {
+            this->work_pending = true;
+        }
+        PERF_TIME(perf_manage_mixture, this->manage_mixture());
+        this->valves.commit(this->valves_forced_off);
+        this->schedule_next_deadline();
+        this->check_status_frame();
+    } else {
+        this->idle_ticks++;
+    }
+
+    eeprom_writer.main();
+    this->save_snapshot();
+    this->report_idle_time();
+    uint8_t budget;
+    PERF_TIME(perf_publish_dirty_status, budget = this->publish_dirty_status(STATUS_PUBLISH_BUDGET));
+    if (budget > 0) {
+        this->publish_event_log();
+    }
+
+#ifdef DOSA_TRACE
+    this->dump_trace();
+#endif
+
+#ifdef DOSA_PROFILE
+    this->perf.add(perf_tick, PERF_CLOCK() - tick_start);
+    this->report_perf();
+#endif
 }
\ No newline at end of file
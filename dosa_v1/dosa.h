@@ -1,6 +1,316 @@
 #ifndef DOSA_H
 #define DOSA_H
 #include "module.h"
+#include "modbus_master.h"
+#include "sensor_filter.h"
+#include "valve_bank.h"
+
+// uncomment to time the stages of main() and publish them under perf/, see perf_stats.h
+// #define DOSA_PROFILE
+
+#ifdef DOSA_PROFILE
+#include "perf_stats.h"
+
+#define PERF_REPORT_MS 60000
+
+// time source of the stage timings. The host profile build counts real ns instead, its micros() is the
+// virtual clock
+#ifndef PERF_CLOCK
+#define PERF_CLOCK micros
+#endif
+
+// timed stages of main(), published as perf/<name>, the dose stages follow dose_channel_id
+enum perf_stage {
+    perf_tick,
+    perf_check_error_state,
+    perf_calculate_ec_ratio,
+    perf_closed_loop,
+    perf_dose_A,
+    perf_dose_B,
+    perf_dose_ph,
+    perf_manage_mixture,
+    perf_modbus,
+    perf_publish_status,
+    perf_publish_dirty_status,
+    perf_stage_count
+};
+#endif
+
+// uncomment to trace control messages, e-stop edges and valve / led outputs, dumped by control/trace-dump
+// #define DOSA_TRACE
+
+#ifdef DOSA_TRACE
+/*
+    Ring of the last TRACE_SIZE inputs and outputs, oldest dropped first. A dump sends one record per tick
+    on status/trace and to Serial as "<millis>,<kind>,<topic or pin>,<value>", oldest first, and recording
+    pauses until it is done. Message payloads are cut to TRACE_VALUE_LENGTH - 1 characters.
+*/
+#define TRACE_SIZE 32
+#define TRACE_VALUE_LENGTH 10
+
+enum trace_kind {trace_message, trace_emergency_stop, trace_output};
+
+struct Trace_Record {
+    uint32_t ms;
+    uint8_t kind;
+    uint8_t id;                         // control topic id for messages, the pin otherwise
+    char value[TRACE_VALUE_LENGTH];
+};
+#endif
+
+/*
+    Compact status frame, published hex encoded on status/frame when publish_status_frame is set.
+    Fixed layout, little endian, bump STATUS_FRAME_VERSION on any change:
+        0   u8   version
+        1   u8   control flags: ec-dose, ph-dose, run-mixture, dose-lockout (bits 0-3)
+        2   u8   valve flags: ph, mixture, nutrient A, nutrient B (bits 0-3)
+        3   u8   lockout flags: control, ec timer, ph timer, emergency stop (bits 0-3)
+        4   u8   lockout type
+        5   i16  ph pin
+        7   i16  mixture pin
+        9   i16  nutrient A pin
+        11  i16  nutrient B pin
+        13  i16  emergency stop pin
+        15  f32  flow rate lpm
+        19  f32  ratio of A to B %
+        23  i32  ph dose time s
+        27  f32  nutrient A dosing time ms
+        31  f32  nutrient B dosing time ms
+        35  f32  dose amount l
+*/
+#define STATUS_FRAME_VERSION 1
+#define STATUS_FRAME_LENGTH 39
+
+/*
+    Outbound publish queue, one bit per topic (or topic group) waiting to go out, drained lowest bit first.
+    A bit only carries "changed", the value is read when it is published, so superseded values coalesce.
+    Three priority classes: safety bits all go out as soon as the broker is there, ignoring the budget,
+    actuation and informational bits share the per-tick budget. While the broker is away safety and
+    actuation bits wait, informational bits are dropped, publish_status() marks them all again on reconnect.
+*/
+enum status_bit : uint8_t {
+    // safety
+    status_doser_lockout,
+    status_lockout_ec,
+    status_lockout_ph,
+    status_emergency_stop,
+    status_lockout_summary,         // group: the dose-lockout based lockout topics sent on connect
+    // actuation
+    status_nutrient_A_valve,
+    status_nutrient_B_valve,
+    status_ph_valve,
+    status_mixture_valve,
+    status_nutrient_A_time,
+    status_nutrient_B_time,
+    status_control,                 // group: control/ values
+    status_frame,
+    status_settled,
+    // informational
+    status_identity,                // group: mac address, firmware type
+    status_hardware,                // group: hardware/ pins
+    status_emergency_stop_latency,
+    status_idle_percent,
+    status_draw_rates,              // group: learned venturi draw rates
+    status_recipe_step,
+    status_publish_queue,
+    status_bit_count
+};
+
+#define STATUS_ACTUATION_FIRST status_nutrient_A_valve
+#define STATUS_INFORMATIONAL_FIRST status_identity
+
+// publishes per main() tick for the actuation and informational classes, the rest wait for the next tick
+#define STATUS_PUBLISH_BUDGET 2
+
+// longest main() will go without re-evaluating the dose logic when no deadline is pending
+#define IDLE_RECHECK_MS 1000
+
+// window over which status/idle-percent is measured
+#define IDLE_REPORT_MS 60000
+
+// emergency stop interrupt latency histogram, bucket n counts latencies below 2^(n + 2) us, the last bucket the rest
+#define ESTOP_LATENCY_BUCKETS 8
+
+/*
+    Dosing heads one controller can drive, and the SRAM all of them together may take, checked at build
+    time on AVR along with their EEPROM records. Both can be defined before this header is included. Past
+    four heads the event log defaults to six records instead of sixteen, a Mega 2560 fits eight heads in the
+    default budget at 626 bytes a head. The DOSA_PROFILE stage table and the DOSA_TRACE ring are counted
+    too and add about 440 and 520 bytes a head, a profiled or traced build defaults to four heads.
+*/
+#ifndef DOSA_MAX_INSTANCES
+#if defined(DOSA_PROFILE) || defined(DOSA_TRACE)
+#define DOSA_MAX_INSTANCES 4
+#else
+#define DOSA_MAX_INSTANCES 8
+#endif
+#endif
+#ifndef DOSA_RAM_BUDGET
+#define DOSA_RAM_BUDGET 5120
+#endif
+
+// storage class of the controller wide registries in dosa.cpp. Empty on the board, the host parameter sweep
+// builds with thread_local so each worker thread is a controller of its own
+#ifndef DOSA_GLOBAL
+#define DOSA_GLOBAL
+#endif
+
+// closed loop pulses shorter than this are skipped, longer ones are capped at this share of the safety timer
+#define CLOSED_LOOP_MIN_PULSE_MS 100
+#define CLOSED_LOOP_MAX_PULSE_PERCENT 80
+
+// draw rate estimator: forgetting factor, starting covariance, and the range around the nominal draw it may learn
+#define DRAW_RLS_FORGET 0.98
+#define DRAW_RLS_P0 100.0
+#define DRAW_RLS_MIN_FACTOR 0.25
+#define DRAW_RLS_MAX_FACTOR 4.0
+
+// flow sensor interrupts available across all instances, the Mega has six external interrupt pins
+#define FLOW_SENSOR_SLOTS 6
+
+// how often main() checks a volumetric dose, the valve itself is closed from the sensor interrupt
+#define FLOW_SENSOR_POLL_MS 50
+
+// pulse counter for a dose channel's flow sensor, updated from the sensor interrupt
+struct Flow_Sensor {
+    short valve_pin;
+    volatile uint32_t pulses;
+    volatile uint32_t target_pulses;    // zero while no volumetric dose is running
+    volatile bool target_reached;
+    volatile uint8_t *forced_off;       // the owner's forced off valves, and this valve's bit in it
+    uint8_t valve_bit;
+};
+
+/*
+    Control snapshot kept in EEPROM so a reset doser can dose again before the broker replays its retained
+    messages. SNAPSHOT_SLOTS copies per instance are written round robin, the valid one with the highest
+    sequence wins. Bump SNAPSHOT_VERSION on any layout change, old snapshots are then ignored.
+*/
+#define SNAPSHOT_VERSION 3
+#ifndef SNAPSHOT_SLOTS
+#define SNAPSHOT_SLOTS 4
+#endif
+#define SNAPSHOT_CHECK_MS 1000
+#define SNAPSHOT_WRITE_MS 30000
+
+struct Dosa_Snapshot {
+    uint8_t version;
+    uint8_t flags;              // dose lockout, closed loop (bits 0-1)
+    uint16_t sequence;
+    uint32_t flow_rate_mlpm;
+    uint16_t ratio_of_A_to_B_centi;
+    uint8_t lockout_type;
+    uint8_t reserved;
+    int32_t ph_dose_time_s;
+    float ec_setpoint;
+    float ph_setpoint;
+    float ec_draw_ml_per_s;     // learned draw rates, zero if never learned
+    float ec_drift_ml_per_min;
+    float ec_draw_p[3];         // RLS covariance of draw and drift, p00 p01 p11
+    float ph_draw_ml_per_s;
+    float ph_drift_ml_per_min;
+    float ph_draw_p[3];
+    uint16_t crc;
+};
+
+/*
+    Dose event log. Every valve open/close, lockout and emergency stop is appended as a fixed 8 byte record to
+    a ring of EVENT_LOG_SIZE and drained oldest first in batches on status/events, so events that happen while
+    the broker is away are still delivered once it is back. A full ring drops its oldest record, the backend
+    sees the jump in sequence numbers. Batch payload, hex encoded, little endian, bump EVENT_LOG_VERSION on
+    any change:
+        0   u8   version
+        1   u32  sequence number of the first record
+        5   u8   record count
+        6   u32  ms from the last record to the publish
+        10  records, EVENT_RECORD_LENGTH bytes each:
+            0  u16  tenths of a second since the previous record, saturates at 0xffff
+            2  u8   event type (bits 0-3), cause (bits 4-7)
+            3  u8   channel, see dose_channel_id, EVENT_MIXTURE_CHANNEL or EVENT_NO_CHANNEL
+            4  u32  ms the valve was open, valve close events only
+*/
+#define EVENT_LOG_VERSION 1
+#ifndef EVENT_LOG_SIZE
+#if DOSA_MAX_INSTANCES > 4
+#define EVENT_LOG_SIZE 6
+#else
+#define EVENT_LOG_SIZE 16
+#endif
+#endif
+#define EVENT_BATCH 8
+#define EVENT_FLUSH_MS 5000
+#define EVENT_HEADER_LENGTH 10
+#define EVENT_RECORD_LENGTH 8
+#define EVENT_MIXTURE_CHANNEL 0xfe
+#define EVENT_NO_CHANNEL 0xff
+
+enum event_type {
+    event_valve_open,
+    event_valve_close,
+    event_lockout,              // cause is the lockout type
+    event_lockout_release,
+    event_emergency_stop_pressed,
+    event_emergency_stop_released
+};
+
+// why a valve moved
+enum event_cause {
+    cause_request,
+    cause_timer,
+    cause_volume,
+    cause_lockout,
+    cause_emergency_stop
+};
+
+struct Dose_Event {
+    uint16_t delta_ds;
+    uint8_t type_cause;
+    uint8_t channel;
+    uint32_t duration_ms;
+};
+
+/*
+    Recipe, a day of setpoints run on the doser itself so dosing keeps its cadence without the broker.
+    Loaded with control/recipe as "<HH:MM>,<ec>,<ph>,<ratio of A to B %>,<ph dose time s>" steps separated by
+    ';', in start time order. A step runs from its start until the next step starts, the last one carries
+    on past midnight into the first. The time of day comes from control/time-of-day ("HH:MM" or "HH:MM:SS"),
+    nothing runs until the first one arrives, and one clock is shared by every instance. Kept only in EEPROM,
+    after the snapshots of all instances, the steps are read back from there as they are needed. Bump
+    RECIPE_VERSION on any layout change.
+*/
+#define RECIPE_VERSION 1
+#define RECIPE_STEPS 8
+#define RECIPE_CHECK_MS 10000
+#define DAY_MS 86400000UL
+
+struct Recipe_Step {
+    uint16_t start_minute;
+    uint16_t ratio_of_A_to_B_centi;
+    uint16_t ph_dose_time_s;
+    float ec_setpoint;
+    float ph_setpoint;
+};
+
+struct Dosa_Recipe {
+    uint8_t version;
+    uint8_t steps;
+    Recipe_Step step[RECIPE_STEPS];
+    uint16_t crc;
+};
+
+struct Dosa_Clock {
+    bool synced;
+    unsigned long day_ms;               // time of day at millis
+    unsigned long millis;
+};
+
+// dose channels, run in this order every tick. A new channel needs an id here and its set up in the constructor
+enum dose_channel_id {
+    dose_channel_A,
+    dose_channel_B,
+    dose_channel_ph,
+    dose_channel_count
+};
 
 
 class Dosa_Cls: public Module_Cls {
@@ -13,10 +323,45 @@ class Dosa_Cls: public Module_Cls {
     short nutrient_A_valve_pin;
     short nutrient_B_valve_pin;
     float dose_amount_l;
+    long safety_timout_limit_s;             // longest a dose valve may stay open before it locks out, in ms
     short emergency_stop_pin;
     short lockout_led_pin;
 
+    // optional hall effect flow sensors on the concentrate lines, zero keeps the channel time based
+    short nutrient_A_flow_sensor_pin;
+    short nutrient_B_flow_sensor_pin;
+    short ph_flow_sensor_pin;
+    float flow_sensor_pulses_per_ml;
+
+    // optional on-device Modbus sensors feeding the closed loop, sensor ids from modbus->add_sensor()
+    Modbus_Master_Cls *modbus;
+    int8_t ec_sensor;
+    int8_t ph_sensor;
+
+    // first EEPROM byte of the control snapshots, each instance uses SNAPSHOT_SLOTS records from here on.
+    // -1 leaves the EEPROM alone
+    int eeprom_address;
+
+    // send publish_status() as one status/frame message instead of one topic per field
+    bool publish_status_frame;
+
+    // split each EC dose into this many sub-pulses, alternating A and B with a rest between them. 1 doses
+    // A and B in one opening each, side by side
+    uint8_t ec_split_pulses;
+    unsigned long split_rest_ms;            // about the time the loop needs to carry a pulse through the tank
+
+    // closed loop tuning, used when control/closed-loop is on
+    float venturi_draw_ml_per_s;            // concentrate drawn per second of valve time
+    float ec_rise_per_ml;                   // tank EC rise per ml of A + B, zero leaves EC open loop
+    float ph_drop_per_ml;                   // tank pH drop per ml of pH down, zero leaves pH open loop
+    float closed_loop_kp;
+    float closed_loop_ki;
+    unsigned long closed_loop_interval_ms;  // longest wait after a dose before acting on readings
+    unsigned long settle_min_ms;            // shortest wait, covers the time for a dose to reach the sensor
+
     Dosa_Cls();
+    static Dosa_Cls *route(char *topic);
+    static bool dispatch(char *topic, char *payload);
     void init();
     void main();
     void publish_status();
@@ -28,78 +373,209 @@ class Dosa_Cls: public Module_Cls {
 
   private:
 
-    float flow_rate;
-    float ratio_of_A_to_B;
-    float prev_ratio_of_A_to_B;
+    // dose timing is integer only, control values are converted to fixed point once when they arrive
+    uint32_t flow_rate_mlpm;
+    uint16_t ratio_of_A_to_B_centi;    // hundredths of a percent, 0 - 10000
     long ph_dose_time_s;
     bool needs_to_dose_ec;
     bool needs_to_dose_ph;
     bool dose_lockout;
-    bool prev_dose_lockout;
-    bool mixture_valve_pin_state;
-    bool prev_mixture_valve_pin_state;
-    bool ph_valve_pin_state;
-    bool prev_ph_valve_pin_state;
-    bool nutrient_A_valve_pin_state;
-    bool prev_nutrient_A_valve_pin_state;
-    bool nutrient_B_valve_pin_state;
-    bool prev_nutrient_B_valve_pin_state;
 
-    // State Machines
-    enum ph_state {ph_dose_start, ph_dose_run_timer, ph_dose_idle, ph_dose_end};
-    ph_state ph_dose_state;
+    // status block, packed into bits, changes are flagged in status_dirty rather than shadowed
+    bool mixture_valve_pin_state : 1;
+    bool lockout_state_control : 1;
+    bool lockout_state_ec : 1;
+    bool lockout_state_ph : 1;
+    bool emergency_stop_state : 1;
+    bool current_emergency_stop_state : 1;
+    bool current_mixture_state : 1;
+    bool lockout_led_state : 1;
+    bool ec_ratio_changed : 1;
+    uint32_t status_dirty;
 
-    enum ec_state {ec_dose_start, ec_dose_run_timer, ec_dose_idle, ec_dose_end};
-    ec_state ec_A_dose_state; 
-    ec_state ec_B_dose_state;
+    // State Machines
+    enum dose_state : uint8_t {dose_start, dose_run_timer, dose_idle, dose_end, dose_rest};
 
-    enum lockout_state {none_lockout, safety_dose_lockout, safety_timer_lockout_EC, safety_timer_lockout_PH, emergency_stop_button};
+    enum lockout_state : uint8_t {none_lockout, safety_dose_lockout, safety_timer_lockout_EC, safety_timer_lockout_PH, emergency_stop_button};
     lockout_state lockout_type;
 
-    float dose_ph_timer;
-    float dose_A_timer;
-    float dose_B_timer;
-    float dose_A_time_s;
-    float prev_dose_A_time_s;
-    float dose_B_time_s;
-    float prev_dose_B_time_s;
+    // closed loop EC / pH control from setpoints and readings
+    struct Dose_Loop {
+        float setpoint;
+        float reading;
+        float integral;
+        bool stepped : 1;           // a dose has gone in towards the current setpoint
+        bool reading_fresh : 1;
+        bool mixing : 1;            // a dose went in, readings wait until the tank settles
+        bool measuring : 1;
+        unsigned long last_dose;
+        Sensor_Filter_Cls filter;
+        float draw_ml_per_s;        // learned venturi draw, zero until the first update
+        float drift_ml_per_min;     // the tank's own drift over a dose, in ml of concentrate
+        float draw_p[3];            // RLS covariance of draw and drift, p00 p01 p11
+        float pre_dose_reading;     // reading when the current dose started
+        unsigned long pre_dose_time;
+        unsigned long dose_valve_ms;    // valve time that went in since pre_dose_reading
+    };
+    struct Dose_Channel {
+        short pin;
+        bool *request;              // control flag that starts a dose, cleared when the dose ends
+        unsigned long duration_ms;  // valve open time, zero disables the channel
+        unsigned long dose_ms;      // duration_ms when the running dose started
+        unsigned long pulse_ms;     // the running sub-pulse, dose_ms unless the dose is split
+        unsigned long dosed_ms;     // sub-pulse time already given in the running dose
+        uint8_t pulses;             // sub-pulses in the running dose
+        uint8_t pulses_done;
+        unsigned long timer;
+        dose_state state;
+        lockout_state lockout;      // raised if the valve outlives the safety timer
+        status_bit status;          // valve status topic
+        bool pin_state;
+        int8_t valve_slot;          // in valves, resolved at init()
+        short flow_sensor_pin;
+        Flow_Sensor flow;           // volumetric dosing, the valve closes on volume and the timer is only a backstop
+        Dose_Loop *loop;            // readings this channel moves
+    };
+    Dose_Channel channels[dose_channel_count];
+
+    bool apply_control(uint8_t id, char *payload);
+    bool apply_control_batch(char *payload);
+
     bool calculate_ec_ratio();
-    bool dose_nutrient_a();
-    bool dose_nutrient_b();
-    bool dose_ph();
+    void set_ec_dose_times(unsigned long dose_A_time_ms, unsigned long dose_B_time_ms);
+
+    bool closed_loop;
+    Dose_Loop ec_loop;
+    Dose_Loop ph_loop;
+    void reset_loop(Dose_Loop &loop);
+    bool set_loop_setpoint(Dose_Loop &loop, char *payload);
+    void change_loop_setpoint(Dose_Loop &loop, float setpoint);
+    bool set_loop_reading(Dose_Loop &loop, char *payload);
+    void add_loop_reading(Dose_Loop &loop, float reading);
+    bool loop_settled(Dose_Loop &loop);
+    bool settled;
+    bool request_dose(Dose_Loop &loop, char *payload, bool &request);
+    bool closed_loop_ready(Dose_Loop &loop);
+    unsigned long closed_loop_pulse_ms(Dose_Loop &loop, float error, float change_per_ml);
+    float loop_draw_rate(Dose_Loop &loop);
+    void update_draw_rate(Dose_Loop &loop, float change, float change_per_ml);
+    void run_closed_loop();
+
+    // EEPROM control snapshot, only the newest image's sequence and CRC are kept, and its flags so a lockout
+    // change can skip the write interval
+    uint16_t snapshot_sequence;
+    uint16_t snapshot_crc;
+    uint8_t snapshot_flags;
+    uint8_t snapshot_slot;
+    unsigned long snapshot_check_timer;
+    unsigned long snapshot_write_timer;
+    bool snapshot_writing;              // handed to the EEPROM writer, not all of it written yet
+    int snapshot_address(uint8_t slot);
+    void build_snapshot(Dosa_Snapshot &image);
+    bool restore_snapshot();
+    void save_snapshot();
+
+    // on-device recipe
+    uint8_t recipe_steps;               // in the EEPROM record, zero while there is none or it is being written
+    int8_t recipe_step;                 // step running now, -1 if none
+    unsigned long recipe_timer;
+    int recipe_address();
+    bool load_recipe(char *payload);
+    void save_recipe(Dosa_Recipe &recipe);
+    bool restore_recipe();
+    void read_recipe_step(uint8_t index, Recipe_Step &step);
+    bool set_time_of_day(char *payload);
+    unsigned long time_of_day_ms();
+    void run_recipe();
+    void apply_recipe_step(Recipe_Step &step);
+
+    void read_modbus_sensors();
+    bool run_dose_channels();
+    bool run_dose_channel(Dose_Channel &channel);
+    void start_dose(Dose_Channel &channel);
+    bool next_pulse(Dose_Channel &channel);
+    bool split_channel(Dose_Channel &channel);
+    uint8_t split_turn;                 // dose_channel_id of the EC channel allowed to open next
+    unsigned long split_rest_timer;
+    void set_channel_valve(Dose_Channel &channel, bool state, event_cause cause);
+    void attach_flow_sensor(Dose_Channel &channel);
+    bool volumetric(Dose_Channel &channel);
+    void start_flow_count(Dose_Channel &channel);
+    void stop_flow_count(Dose_Channel &channel);
     bool mixture_state;
-    bool current_mixture_state;
+    int8_t mixture_valve_slot;
     bool manage_mixture();
-    bool pump_state;
-    bool current_pump_state;
-    bool lockout_state_control;
-    bool prev_lockout_state_control;
-    bool lockout_state_ec;
-    bool prev_lockout_state_ec;
-    bool lockout_state_ph;
-    bool prev_lockout_state_ph;
-    bool lockout_state_emergency_stop;    
-    bool emergency_stop_state;
-    bool prev_emergency_stop_state;
-    bool current_emergency_stop_state;
+
+    // dose and mixture valves, written together once per tick
+    Valve_Bank_Cls valves;
+    // bank slots an interrupt has shut, commit() keeps them shut until main() has caught up. The e-stop
+    // forces every channel's slot while its kill is set
+    volatile uint8_t valves_forced_off;
 
     void manage_lockout();
     void manage_emergency_stop(); 
+
+    // emergency stop interrupt, closes the dose valves inside the ISR and latches for main() to pick up
+    volatile bool emergency_stop_latched;
+    volatile bool emergency_stop_kill;      // set with the latch, only the lockout release clears it
+    volatile unsigned long emergency_stop_latency_us;
+    uint16_t emergency_stop_latency_hist[ESTOP_LATENCY_BUCKETS];
+    static void emergency_stop_isr();
+    static void eeprom_write_done(void *owner, uint8_t tag, bool written);
+    void eeprom_written(uint8_t tag, bool written);
+    void latch_emergency_stop();
+    void handle_emergency_stop_latch();
     void check_error_state();
-    long safety_timout_limit_s;
-    bool check_ec_B_safety_timer();
-    bool check_ec_A_safety_timer();
-    bool check_ph_safety_timer();
+    bool check_safety_timer(Dose_Channel &channel);
+
+    // deadline scheduling, the dose logic only runs when a deadline expires or a message changed something
+    bool work_pending;
+    unsigned long next_deadline;
+    unsigned long idle_report_timer;
+    unsigned long ticks;
+    unsigned long idle_ticks;
+    uint8_t idle_percent;
+    void schedule_next_deadline();
+    void report_idle_time();
+
+    // dose event log, ring of event_log_count records from event_log_head
+    Dose_Event event_log[EVENT_LOG_SIZE];
+    uint8_t event_log_head;
+    uint8_t event_log_count;
+    uint32_t event_log_sequence;        // sequence number of the record at event_log_head
+    unsigned long event_log_last;       // millis() of the newest record
+    unsigned long event_log_flush_timer;
+    void log_event(event_type type, uint8_t cause, uint8_t channel, uint32_t duration_ms);
+    void publish_event_log();
+
+#ifdef DOSA_PROFILE
+    Perf_Stats_Cls perf;
+    uint8_t perf_report_stage;          // next stage to publish, perf_stage_count between reports
+    unsigned long perf_report_timer;
+    void report_perf();
+#endif
+
+#ifdef DOSA_TRACE
+    Trace_Record trace_log[TRACE_SIZE];
+    uint8_t trace_head;
+    uint8_t trace_count;
+    uint8_t trace_dump_remaining;
+    void trace(trace_kind kind, uint8_t id, const char *value);
+    void dump_trace();
+#endif
 
     // MQTT publish functions
-    void pub_stat_ph();
-    void pub_doseing_times();
-    void pub_stat_mixture();
-    void pub_stat_nutrient_a();
-    void pub_stat_nutrient_b();
-    void pub_stat_dose_lockout();
-    void pub_stat_dose_lockout_EC();
-    void pub_stat_dose_lockout_PH();
-    void pub_stat_emergency_stop();
+    uint8_t status_queue_max_depth;
+    unsigned long status_coalesced;     // marks that found their topic already waiting
+    unsigned long status_dropped;       // informational publishes shed while the broker was away
+    void mark_status(status_bit bit);
+    uint8_t status_queue_depth();
+    uint8_t publish_dirty_status(uint8_t budget);
+    uint8_t pub_status_bit(uint8_t bit);
+    // CRC of the last status frame published, a frame that no longer matches it is queued again
+    uint16_t status_frame_crc;
+    void build_status_frame(uint8_t *frame);
+    void check_status_frame();
+    void pub_status_frame();
 };
 # endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#endif
+
+#include <eeprom_writer.h>
+
+Eeprom_Writer_Cls::Eeprom_Writer_Cls() {
+    this->address = 0;
+    this->length = 0;
+    this->position = 0;
+    this->owner = NULL;
+    this->tag = 0;
+    this->callback = NULL;
+}
+
+bool Eeprom_Writer_Cls::busy() {
+    return this->owner != NULL;
+}
+
+bool Eeprom_Writer_Cls::owned_by(void *owner, uint8_t tag) {
+    return this->owner == owner && this->tag == tag;
+}
+
+bool Eeprom_Writer_Cls::writing(uint8_t tag) {
+    return this->busy() && this->tag == tag;
+}
+
+bool Eeprom_Writer_Cls::start(void *owner, uint8_t tag, int address, const void *data, uint16_t length,
+                              eeprom_write_callback callback, bool replace) {
+    if (length > EEPROM_WRITER_SIZE) {
+        return false;
+    }
+    if (this->busy()) {
+        if (!replace) {
+            return false;
+        }
+        this->end(false);
+    }
+    memcpy(this->buffer, data, length);
+    this->address = address;
+    this->length = length;
+    this->position = 0;
+    this->owner = owner;
+    this->tag = tag;
+    this->callback = callback;
+    return true;
+}
+
+void Eeprom_Writer_Cls::finish() {
+    while (this->busy()) {
+        EEPROM.update(this->address + this->position, this->buffer[this->position]);
+        if (++this->position == this->length) {
+            this->end(true);
+        }
+    }
+}
+
+void Eeprom_Writer_Cls::main() {
+    for (uint8_t i = 0; i < EEPROM_WRITE_BYTES && this->busy(); i++) {
+#ifdef __AVR__
+        // the last byte is still being written, reading or writing now would wait for it
+        if (!eeprom_is_ready()) {
+            return;
+        }
+#endif
+        int address = this->address + this->position;
+        uint8_t value = this->buffer[this->position];
+        bool changed = EEPROM.read(address) != value;
+        if (changed) {
+            EEPROM.write(address, value);
+        }
+        if (++this->position == this->length) {
+            this->end(true);
+        } else if (changed) {
+            // one byte write per call, the next can not start until this one is done anyway
+            return;
+        }
+    }
+}
+
+void Eeprom_Writer_Cls::end(bool written) {
+    // cleared first, the callback may start the next record
+    void *owner = this->owner;
+    uint8_t tag = this->tag;
+    eeprom_write_callback callback = this->callback;
+    this->owner = NULL;
+    if (callback != NULL) {
+        callback(owner, tag, written);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef EEPROM_WRITER_H
+#define EEPROM_WRITER_H
+#include <Arduino.h>
+
+// largest record it takes, a whole Dosa_Recipe
+#define EEPROM_WRITER_SIZE 136
+// bytes looked at per main(), unchanged bytes are only read
+#define EEPROM_WRITE_BYTES 8
+
+// told when a record is fully written, or when it was dropped for another record before it was
+typedef void (*eeprom_write_callback)(void *owner, uint8_t tag, bool written);
+
+/*
+    Writes one record to EEPROM a few bytes per main() call instead of blocking the loop for the ~3.3 ms
+    every changed byte costs. The record is copied in by start(), so the owner can go on changing its own
+    copy, and written in order, so a trailing CRC is the last byte to land and a reset mid write leaves a
+    record that fails its check. On AVR a byte is only started once the previous one has finished, so
+    main() never waits on the EEPROM at all. One writer is shared by every instance.
+*/
+class Eeprom_Writer_Cls {
+
+  public:
+
+    Eeprom_Writer_Cls();
+    bool busy();
+    bool owned_by(void *owner, uint8_t tag);
+    // a record with this tag is being written, whoever owns it
+    bool writing(uint8_t tag);
+    // false if another record is being written, unless replace drops it
+    bool start(void *owner, uint8_t tag, int address, const void *data, uint16_t length,
+               eeprom_write_callback callback, bool replace);
+    // write what is left of the record now, for when a second record can not wait
+    void finish();
+    void main();
+
+  private:
+
+    uint8_t buffer[EEPROM_WRITER_SIZE];
+    int address;
+    uint16_t length;
+    uint16_t position;
+    void *owner;
+    uint8_t tag;
+    eeprom_write_callback callback;
+
+    void end(bool written);
+};
+#endif
@@ -0,0 +1,254 @@
+#include <Arduino.h>
+
+#include <modbus_master.h>
+
+#define RS485_TRANSMIT HIGH
+#define RS485_RECEIVE LOW
+
+// CRC16/MODBUS, reflected polynomial 0xA001, one table lookup per byte
+const uint16_t modbus_crc_table[256] PROGMEM = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+uint16_t Modbus_Master_Cls::crc16(const uint8_t *data, uint8_t length) {
+    uint16_t crc = 0xFFFF;
+    while (length--) {
+        crc = (crc >> 8) ^ pgm_read_word(&modbus_crc_table[(crc ^ *data++) & 0xFF]);
+    }
+    return crc;
+}
+
+Modbus_Master_Cls::Modbus_Master_Cls() {
+    this->serial = NULL;
+    this->de_pin = 0;
+    this->baud = 9600;
+    this->timeout_ms = 200;
+
+    this->polls = 0;
+    this->timeouts = 0;
+    this->errors = 0;
+
+    this->state = bus_idle;
+    this->sensor_count = 0;
+    this->next_sensor = 0;
+    this->active_sensor = -1;
+    this->frame_length = 0;
+    this->state_timer_us = 0;
+    this->request_timer = 0;
+    this->char_time_us = 0;
+    this->frame_gap_us = 0;
+}
+
+void Modbus_Master_Cls::init() {
+    if (this->serial == NULL) {
+        Serial.println(F("modbus: serial port not set"));
+    }
+    if (this->de_pin != 0) {
+        digitalWrite(this->de_pin, RS485_RECEIVE);
+        pinMode(this->de_pin, OUTPUT);
+    }
+
+    // 11 bit characters, the spec fixes the 3.5 character gap at 1750 us above 19200 baud
+    this->char_time_us = 11000000UL / this->baud;
+    this->frame_gap_us = this->baud > 19200 ? 1750 : (this->char_time_us * 7) / 2;
+}
+
+int8_t Modbus_Master_Cls::add_sensor(uint8_t address, uint8_t function, uint16_t reg, float scale, unsigned long period_ms) {
+    if (this->sensor_count >= MODBUS_MAX_SENSORS) {
+        return -1;
+    }
+    Modbus_Sensor &sensor = this->sensors[this->sensor_count];
+    sensor.address = address;
+    sensor.function = function;
+    sensor.reg = reg;
+    sensor.scale = scale;
+    sensor.period_ms = period_ms;
+    // due straight away
+    sensor.last_poll = millis() - period_ms;
+    sensor.value = 0;
+    sensor.fresh = false;
+    sensor.timeouts = 0;
+    sensor.errors = 0;
+    return this->sensor_count++;
+}
+
+bool Modbus_Master_Cls::read_sensor(int8_t sensor, float *value) {
+    if (sensor < 0 || sensor >= this->sensor_count || !this->sensors[sensor].fresh) {
+        return false;
+    }
+    *value = this->sensors[sensor].value;
+    this->sensors[sensor].fresh = false;
+    return true;
+}
+
+int8_t Modbus_Master_Cls::next_due_sensor() {
+    // round robin from the sensor after the last one polled, so a fast sensor can not starve the others
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < this->sensor_count; i++) {
+        uint8_t index = (this->next_sensor + i) % this->sensor_count;
+        if (now - this->sensors[index].last_poll >= this->sensors[index].period_ms) {
+            this->next_sensor = (index + 1) % this->sensor_count;
+            return index;
+        }
+    }
+    return -1;
+}
+
+void Modbus_Master_Cls::send_request(int8_t sensor) {
+    Modbus_Sensor &target = this->sensors[sensor];
+    uint8_t request[8];
+    request[0] = target.address;
+    request[1] = target.function;
+    request[2] = target.reg >> 8;
+    request[3] = target.reg & 0xFF;
+    request[4] = 0;
+    request[5] = 1;
+    uint16_t crc = crc16(request, 6);
+    request[6] = crc & 0xFF;
+    request[7] = crc >> 8;
+
+    // drop anything left on the line from a late reply
+    while (this->serial->available()) {
+        this->serial->read();
+    }
+
+    if (this->de_pin != 0) {
+        digitalWrite(this->de_pin, RS485_TRANSMIT);
+    }
+    // the request fits the transmit buffer, so write() returns without waiting for the line
+    this->serial->write(request, sizeof(request));
+
+    target.last_poll = millis();
+    this->active_sensor = sensor;
+    this->frame_length = 0;
+    this->state_timer_us = micros();
+    this->polls++;
+    this->state = bus_transmit;
+}
+
+bool Modbus_Master_Cls::receive_response() {
+    // true once a complete frame is in, a read reply is 5 bytes plus 2 per register, an exception 5 bytes
+    while (this->serial->available() && this->frame_length < MODBUS_MAX_FRAME) {
+        this->frame[this->frame_length++] = this->serial->read();
+    }
+    if (this->frame_length >= 5 && (this->frame[1] & 0x80)) {
+        return true;
+    }
+    if (this->frame_length < 3) {
+        return false;
+    }
+    // a byte count that could never fit the buffer is line noise, hand it to parse_response as an error
+    if (this->frame[2] > MODBUS_MAX_FRAME - 5) {
+        return true;
+    }
+    return this->frame_length >= (uint16_t)this->frame[2] + 5;
+}
+
+void Modbus_Master_Cls::parse_response() {
+    Modbus_Sensor &sensor = this->sensors[this->active_sensor];
+    if (!(this->frame[1] & 0x80) && this->frame[2] > MODBUS_MAX_FRAME - 5) {
+        sensor.errors++;
+        this->errors++;
+        return;
+    }
+    uint16_t length = this->frame[1] & 0x80 ? 5 : (uint16_t)this->frame[2] + 5;
+    uint16_t crc = this->frame[length - 2] | (uint16_t)this->frame[length - 1] << 8;
+
+    if (crc != crc16(this->frame, length - 2) || this->frame[0] != sensor.address ||
+        this->frame[1] != sensor.function || this->frame[2] != 2) {
+        sensor.errors++;
+        this->errors++;
+        return;
+    }
+    int16_t raw = (int16_t)((uint16_t)this->frame[3] << 8 | this->frame[4]);
+    sensor.value = raw * sensor.scale;
+    sensor.fresh = true;
+}
+
+void Modbus_Master_Cls::end_exchange() {
+    this->active_sensor = -1;
+    this->state_timer_us = micros();
+    this->state = bus_gap;
+}
+
+void Modbus_Master_Cls::main() {
+    if (this->serial == NULL || this->sensor_count == 0) {
+        return;
+    }
+
+    switch (this->state) {
+
+        case bus_gap:
+            if (micros() - this->state_timer_us < this->frame_gap_us) {
+                return;
+            }
+            this->state = bus_idle;
+            // straight on to the next due sensor rather than losing a loop
+            // fall through
+        case bus_idle: {
+            int8_t sensor = this->next_due_sensor();
+            if (sensor >= 0) {
+                this->send_request(sensor);
+            }
+            break;
+        }
+
+        case bus_transmit:
+            // release the driver once the last request character has left the shift register
+            if (micros() - this->state_timer_us < this->char_time_us * 8) {
+                return;
+            }
+            if (this->de_pin != 0) {
+                digitalWrite(this->de_pin, RS485_RECEIVE);
+            }
+            this->request_timer = millis();
+            this->state = bus_receive;
+            break;
+
+        case bus_receive:
+            if (this->receive_response()) {
+                this->parse_response();
+                this->end_exchange();
+            } else if (millis() - this->request_timer > this->timeout_ms) {
+                this->sensors[this->active_sensor].timeouts++;
+                this->timeouts++;
+                this->end_exchange();
+            }
+            break;
+
+        default:
+            this->state = bus_idle;
+            break;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef MODBUS_MASTER_H
+#define MODBUS_MASTER_H
+#include <Arduino.h>
+
+#define MODBUS_MAX_SENSORS 6
+#define MODBUS_MAX_FRAME 16
+
+// read holding / input registers, the only functions the sensors need
+#define MODBUS_READ_HOLDING 0x03
+#define MODBUS_READ_INPUT 0x04
+
+struct Modbus_Sensor {
+    uint8_t address;
+    uint8_t function;
+    uint16_t reg;
+    float scale;                // raw register value times scale gives the reading
+    unsigned long period_ms;
+    unsigned long last_poll;
+    float value;
+    bool fresh;                 // a new value since the last read_sensor()
+    uint16_t timeouts;
+    uint16_t errors;
+};
+
+/*
+    Non-blocking Modbus RTU master for the RS485 sensors. main() is called every loop and only ever moves
+    the bus state machine on, it never waits for the line. One request is on the bus at a time (RS485 is
+    half duplex), the next due sensor is sent as soon as the previous exchange and the inter-frame gap are
+    over, in the same main() call.
+*/
+class Modbus_Master_Cls {
+
+  public:
+
+    Stream *serial;
+    short de_pin;               // RS485 driver enable, zero for transceivers that switch themselves
+    unsigned long baud;
+    unsigned long timeout_ms;
+
+    Modbus_Master_Cls();
+    void init();
+    void main();
+    int8_t add_sensor(uint8_t address, uint8_t function, uint16_t reg, float scale, unsigned long period_ms);
+    bool read_sensor(int8_t sensor, float *value);
+
+    unsigned long polls;
+    unsigned long timeouts;
+    unsigned long errors;
+
+    static uint16_t crc16(const uint8_t *data, uint8_t length);
+
+  private:
+
+    enum bus_state {bus_idle, bus_transmit, bus_receive, bus_gap};
+    bus_state state;
+
+    Modbus_Sensor sensors[MODBUS_MAX_SENSORS];
+    uint8_t sensor_count;
+    uint8_t next_sensor;
+    int8_t active_sensor;
+
+    uint8_t frame[MODBUS_MAX_FRAME];
+    uint8_t frame_length;
+    unsigned long state_timer_us;
+    unsigned long request_timer;
+    unsigned long char_time_us;
+    unsigned long frame_gap_us;
+
+    int8_t next_due_sensor();
+    void send_request(int8_t sensor);
+    bool receive_response();
+    void parse_response();
+    void end_exchange();
+};
+#endif
@@ -0,0 +1,62 @@
+#include <Arduino.h>
+
+#include <perf_stats.h>
+
+Perf_Stats_Cls::Perf_Stats_Cls() {
+    for (uint8_t i = 0; i < PERF_MAX_STAGES; i++) {
+        this->reset(i);
+    }
+}
+
+void Perf_Stats_Cls::add(uint8_t stage, uint32_t elapsed_us) {
+    if (stage >= PERF_MAX_STAGES) {
+        return;
+    }
+    Perf_Stage &s = this->stages[stage];
+
+    if (s.count == 0 || elapsed_us < s.min_us) {
+        s.min_us = elapsed_us;
+    }
+    if (elapsed_us > s.max_us) {
+        s.max_us = elapsed_us;
+    }
+    s.count++;
+    s.total_us += elapsed_us;
+
+    uint8_t bucket = 0;
+    while (bucket < PERF_BUCKETS - 1 && elapsed_us >= (8UL << bucket)) {
+        bucket++;
+    }
+    if (s.hist[bucket] < 0xffff) {
+        s.hist[bucket]++;
+    }
+}
+
+void Perf_Stats_Cls::reset(uint8_t stage) {
+    if (stage >= PERF_MAX_STAGES) {
+        return;
+    }
+    memset(&this->stages[stage], 0, sizeof(Perf_Stage));
+}
+
+void Perf_Stats_Cls::format(uint8_t stage, char *line) {
+    line[0] = '\0';
+    if (stage >= PERF_MAX_STAGES) {
+        return;
+    }
+    Perf_Stage &s = this->stages[stage];
+    uint32_t fields[4] = {s.count, s.min_us, s.max_us, s.count > 0 ? s.total_us / s.count : 0};
+
+    char *pos = line;
+    for (uint8_t i = 0; i < 4; i++) {
+        ultoa(fields[i], pos, 10);
+        pos += strlen(pos);
+        *pos++ = ',';
+    }
+    for (uint8_t i = 0; i < PERF_BUCKETS; i++) {
+        utoa(s.hist[i], pos, 10);
+        pos += strlen(pos);
+        *pos++ = ',';
+    }
+    *(pos - 1) = '\0';
+}
@@ -0,0 +1,36 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+#include <Arduino.h>
+
+/*
+    Stage timing for Dosa_Cls::main(), only built with DOSA_PROFILE defined. Each stage keeps a count, min,
+    max and total in us plus a log histogram, bucket n counts times below 2^(n + 3) us and the last bucket
+    the rest. format() writes one stage as "count,min,max,mean,h0,...,h9", the same line whether it is
+    published under perf/ by the doser or printed by a host benchmark linking this file.
+*/
+#define PERF_MAX_STAGES 12
+#define PERF_BUCKETS 10
+#define PERF_LINE_LENGTH 128
+
+struct Perf_Stage {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t total_us;
+    uint16_t hist[PERF_BUCKETS];
+};
+
+class Perf_Stats_Cls {
+
+  public:
+
+    Perf_Stats_Cls();
+    void add(uint8_t stage, uint32_t elapsed_us);
+    void reset(uint8_t stage);
+    void format(uint8_t stage, char *line);
+
+  private:
+
+    Perf_Stage stages[PERF_MAX_STAGES];
+};
+#endif
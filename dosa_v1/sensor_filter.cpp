@@ -0,0 +1,82 @@
+#include <Arduino.h>
+
+#include <sensor_filter.h>
+
+Sensor_Filter_Cls::Sensor_Filter_Cls() {
+    this->alpha = 0.3;
+    this->slope_threshold = 0.005;
+    this->variance_threshold = 0.0004;
+    this->min_samples = 6;
+
+    this->value = 0;
+    this->slope_per_min = 0;
+    this->variance = 0;
+    this->samples = 0;
+
+    this->window_pos = 0;
+    this->window_count = 0;
+    this->samples_since_restart = 0;
+    this->last_sample = 0;
+}
+
+float Sensor_Filter_Cls::median() {
+    // insertion sort of at most five values, a fixed cost per sample
+    float sorted[SENSOR_FILTER_MEDIAN];
+    for (uint8_t i = 0; i < this->window_count; i++) {
+        float v = this->window[i];
+        int8_t j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    return sorted[this->window_count / 2];
+}
+
+void Sensor_Filter_Cls::add(float reading, unsigned long now) {
+    this->window[this->window_pos] = reading;
+    this->window_pos = (this->window_pos + 1) % SENSOR_FILTER_MEDIAN;
+    if (this->window_count < SENSOR_FILTER_MEDIAN) {
+        this->window_count++;
+    }
+    float filtered = this->median();
+
+    if (this->samples == 0) {
+        this->value = filtered;
+        this->slope_per_min = 0;
+        this->variance = 0;
+    } else {
+        float previous = this->value;
+        this->value += this->alpha * (filtered - this->value);
+
+        unsigned long elapsed = now - this->last_sample;
+        if (elapsed > 0) {
+            float slope = (this->value - previous) * 60000.0 / elapsed;
+            this->slope_per_min += this->alpha * (slope - this->slope_per_min);
+        }
+        float deviation = filtered - this->value;
+        this->variance += this->alpha * (deviation * deviation - this->variance);
+    }
+
+    this->last_sample = now;
+    if (this->samples < 0xffff) {
+        this->samples++;
+    }
+    if (this->samples_since_restart < 0xffff) {
+        this->samples_since_restart++;
+    }
+}
+
+void Sensor_Filter_Cls::restart() {
+    // a dose just went in, the old readings say nothing about whether it has mixed
+    this->samples_since_restart = 0;
+}
+
+bool Sensor_Filter_Cls::settled() {
+    if (this->samples_since_restart < this->min_samples) {
+        return false;
+    }
+    float slope = this->slope_per_min < 0 ? -this->slope_per_min : this->slope_per_min;
+    return slope < this->slope_threshold && this->variance < this->variance_threshold;
+}
@@ -0,0 +1,41 @@
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+#include <Arduino.h>
+
+#define SENSOR_FILTER_MEDIAN 5
+
+/*
+    Streaming filter for EC / pH readings, constant work per sample: a rolling median of the last five
+    readings knocks out single spikes, an EMA smooths what is left, and the EMA's rate of change and the
+    spread of the median around it tell when the tank has finished mixing.
+*/
+class Sensor_Filter_Cls {
+
+  public:
+
+    float alpha;                    // EMA weight of a new sample
+    float slope_threshold;          // settled below this change per minute
+    float variance_threshold;       // and below this spread around the EMA
+    uint8_t min_samples;            // samples needed after a restart before settled() can be true
+
+    float value;
+    float slope_per_min;
+    float variance;
+    uint16_t samples;
+
+    Sensor_Filter_Cls();
+    void add(float reading, unsigned long now);
+    void restart();
+    bool settled();
+
+  private:
+
+    float window[SENSOR_FILTER_MEDIAN];
+    uint8_t window_pos;
+    uint8_t window_count;
+    uint16_t samples_since_restart;
+    unsigned long last_sample;
+
+    float median();
+};
+#endif
@@ -0,0 +1,93 @@
+#include <Arduino.h>
+
+#include <bridge_device.h>
+#include <valve_bank.h>
+
+Valve_Bank_Cls::Valve_Bank_Cls() {
+    this->device = NULL;
+    this->count = 0;
+    this->states = 0;
+    this->dirty = 0;
+}
+
+int8_t Valve_Bank_Cls::add(short pin) {
+    // -1 for an unset pin or a full bank, set() ignores it
+    if (pin == 0 || this->count >= VALVE_BANK_SIZE) {
+        return -1;
+    }
+    this->pins[this->count] = pin;
+#ifdef __AVR__
+    this->ports[this->count] = portOutputRegister(digitalPinToPort(pin));
+    this->masks[this->count] = digitalPinToBitMask(pin);
+#endif
+    return this->count++;
+}
+
+void Valve_Bank_Cls::set(int8_t slot, bool state) {
+    if (slot < 0) {
+        return;
+    }
+    uint8_t bit = 1 << slot;
+    this->states = state ? this->states | bit : this->states & ~bit;
+    this->dirty |= bit;
+}
+
+void Valve_Bank_Cls::commit(const volatile uint8_t &forced_off) {
+    if (this->dirty == 0) {
+        return;
+    }
+
+#ifdef __AVR__
+    // gather the staged slots into one set / clear mask pair per port
+    volatile uint8_t *ports[VALVE_BANK_SIZE];
+    uint8_t set[VALVE_BANK_SIZE];
+    uint8_t clear[VALVE_BANK_SIZE];
+    uint8_t slot_write[VALVE_BANK_SIZE];
+    uint8_t writes = 0;
+    for (uint8_t i = 0; i < this->count; i++) {
+        if (!(this->dirty & (1 << i))) {
+            continue;
+        }
+        uint8_t w = 0;
+        while (w < writes && ports[w] != this->ports[i]) {
+            w++;
+        }
+        if (w == writes) {
+            ports[w] = this->ports[i];
+            set[w] = 0;
+            clear[w] = 0;
+            writes++;
+        }
+        slot_write[i] = w;
+        if (this->states & (1 << i)) {
+            set[w] |= this->masks[i];
+        } else {
+            clear[w] |= this->masks[i];
+        }
+    }
+
+    // one lock around all the writes, so the flow sensor and e-stop interrupts never land mid port update
+    noInterrupts();
+    // an interrupt may have shut a staged open valve since it was staged, leave it shut
+    uint8_t forced = forced_off & this->dirty & this->states;
+    for (uint8_t i = 0; forced != 0 && i < this->count; i++) {
+        if (forced & (1 << i)) {
+            set[slot_write[i]] &= ~this->masks[i];
+        }
+    }
+    for (uint8_t w = 0; w < writes; w++) {
+        *ports[w] = (*ports[w] & ~clear[w]) | set[w];
+    }
+    interrupts();
+#else
+    noInterrupts();
+    for (uint8_t i = 0; i < this->count; i++) {
+        uint8_t bit = 1 << i;
+        if (this->dirty & bit) {
+            this->device->set_pin(this->pins[i], (this->states & bit) && !(forced_off & bit));
+        }
+    }
+    interrupts();
+#endif
+    this->dirty = 0;
+}
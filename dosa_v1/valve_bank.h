@@ -0,0 +1,40 @@
+#ifndef VALVE_BANK_H
+#define VALVE_BANK_H
+#include <Arduino.h>
+
+class Bridge_Device_Cls;
+
+#define VALVE_BANK_SIZE 4
+
+/*
+    Valve outputs changed during a main() tick are staged here and written together by commit(), one
+    read-modify-write per AVR port with interrupts off, so valves asked to move on the same tick move on
+    the same instruction. The pin to port mapping is resolved once by add(). Only staged changes are
+    written, and a valve the owner's interrupts have closed since it was staged open stays closed: commit()
+    takes their forced off slots and reads them inside the lock. Boards without direct port access fall
+    back to device->set_pin() per valve.
+*/
+class Valve_Bank_Cls {
+
+  public:
+
+    Bridge_Device_Cls *device;
+
+    Valve_Bank_Cls();
+    int8_t add(short pin);
+    void set(int8_t slot, bool state);
+    // slots set in forced_off are not opened, whatever was staged for them
+    void commit(const volatile uint8_t &forced_off);
+
+  private:
+
+    short pins[VALVE_BANK_SIZE];
+#ifdef __AVR__
+    volatile uint8_t *ports[VALVE_BANK_SIZE];
+    uint8_t masks[VALVE_BANK_SIZE];
+#endif
+    uint8_t count;
+    uint8_t states;                 // bit per slot
+    uint8_t dirty;                  // slots staged since the last commit
+};
+#endif
@@ -0,0 +1,447 @@
+/*
+    Dosa_Cls::main() cost per tick on the host, for the idle, active dosing, lockout and reconnect paths,
+    then the loop with more heads on one controller, one of them dosing, then inbound control messages a
+    second through the topic table against the old chain of path compares and the single dispatch entry,
+    then a full dose setup sent as one message per control topic against the same setup in one
+    control/batch, then the EC dose window worked out in float as it was and in fixed point. Host numbers
+    are not AVR numbers, they are a baseline to compare a change to the hot loop against.
+
+    dosa_bench_profile is the same with DOSA_PROFILE and prints each scenario's perf/ report as the doser
+    publishes it, "count,min,max,mean,h0,...,h9" a stage, in real ns rather than us.
+
+    dosa_bench [ticks per scenario]
+*/
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+#include <rig.h>
+#include <utils.h>
+
+typedef void (*bench_step)(Dosa_Cls *dosa, unsigned long tick);
+
+struct Bench_Result {
+    double mean_ns;
+    double max_ns;
+    double mean_cycles;
+    unsigned long publishes;
+    unsigned long pin_writes;
+};
+
+static Bench_Result run_scenario(Dosa_Cls *dosa, unsigned long ticks, bench_step step) {
+    Bench_Result result = {0, 0, 0, 0, 0};
+    double total_ns = 0;
+    double total_cycles = 0;
+    for (unsigned long tick = 0; tick < ticks; tick++) {
+        host_advance_ms(1);
+        if (step != NULL) {
+            step(dosa, tick);
+        }
+        // the records grow without bound, empty them outside the timed part
+        result.publishes += host_publishes.size();
+        result.pin_writes += host_pin_writes.size();
+        host_publishes.clear();
+        host_pin_writes.clear();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        unsigned long long cycles = BENCH_CYCLES();
+        dosa->main();
+        cycles = BENCH_CYCLES() - cycles;
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        total_ns += ns;
+        total_cycles += cycles;
+        if (ns > result.max_ns) {
+            result.max_ns = ns;
+        }
+    }
+    result.publishes += host_publishes.size();
+    result.pin_writes += host_pin_writes.size();
+    result.mean_ns = total_ns / ticks;
+    result.mean_cycles = total_cycles / ticks;
+    return result;
+}
+
+#ifdef DOSA_PROFILE
+// bring the next perf/ report forward and print it, one stage goes out a tick
+static void print_perf_report(Dosa_Cls *dosa) {
+    host_publishes.clear();
+    host_advance_ms(PERF_REPORT_MS);
+    for (uint8_t tick = 0; tick <= perf_stage_count; tick++) {
+        host_advance_ms(1);
+        dosa->main();
+    }
+    for (size_t i = 0; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic.compare(0, 5, "perf/") == 0) {
+            printf("  %-26s %s\n", host_publishes[i].topic.c_str(), host_publishes[i].value.c_str());
+        }
+    }
+}
+#endif
+
+static Dosa_Cls *bench_doser() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ph-dose-time-s", "2");
+    // past the boot publishes, so every scenario starts from a quiet queue
+    rig_run(dosa, 1000);
+    return dosa;
+}
+
+static void dose_step(Dosa_Cls *dosa, unsigned long tick) {
+    // ask again as soon as the last dose could have finished, so the valves are nearly always busy
+    if (tick % 4000 == 0) {
+        rig_control(dosa, "ec-dose", "true");
+        rig_control(dosa, "ph-dose", "true");
+        rig_control(dosa, "run-mixture", tick % 8000 == 0 ? "true" : "false");
+    }
+}
+
+static void lockout_step(Dosa_Cls *dosa, unsigned long tick) {
+    if (tick == 0) {
+        rig_control(dosa, "dose-lockout", "true");
+    }
+    // requests keep arriving and keep being dropped
+    if (tick % 1000 == 0) {
+        rig_control(dosa, "ec-dose", "true");
+    }
+}
+
+static void reconnect_step(Dosa_Cls *, unsigned long) {
+    // the bridge raises this for one loop after the control client reconnects, here on every tick
+    rig_device.new_control_connection = true;
+}
+
+struct Bench_Scenario {
+    const char *name;
+    bench_step step;
+};
+
+static const Bench_Scenario scenarios[] = {
+    {"idle", NULL},
+    {"active-dosing", dose_step},
+    {"lockout", lockout_step},
+    {"reconnect", reconnect_step},
+};
+
+// every head's main() once per tick, head 0 dosing and the rest idle
+static double run_heads(uint8_t heads, unsigned long ticks) {
+    rig_reset();
+    Dosa_Cls *dosas[DOSA_MAX_INSTANCES];
+    for (uint8_t i = 0; i < heads; i++) {
+        dosas[i] = rig_start();
+        rig_control(dosas[i], "flow-rate-lpm", "10");
+        rig_control(dosas[i], "ratio-of-A-to-B-%", "50");
+        rig_control(dosas[i], "ph-dose-time-s", "2");
+    }
+    for (unsigned long tick = 0; tick < 1000; tick++) {
+        host_advance_ms(1);
+        for (uint8_t i = 0; i < heads; i++) {
+            dosas[i]->main();
+        }
+    }
+
+    double total_ns = 0;
+    for (unsigned long tick = 0; tick < ticks; tick++) {
+        host_advance_ms(1);
+        dose_step(dosas[0], tick);
+        host_publishes.clear();
+        host_pin_writes.clear();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint8_t i = 0; i < heads; i++) {
+            dosas[i]->main();
+        }
+        total_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+    for (uint8_t i = 0; i < heads; i++) {
+        delete dosas[i];
+    }
+    return total_ns / ticks;
+}
+
+// a dose setup, one control topic each or all of it in one control/batch
+static const char *const setup_names[] = {
+    "flow-rate-lpm", "ratio-of-A-to-B-%", "ph-dose-time-s", "ec-setpoint", "ph-setpoint", "closed-loop", "ec-dose",
+};
+static const char *const setup_values[] = {"10", "40", "5", "1.5", "6.2", "false", "false"};
+#define SETUP_TOPICS (sizeof(setup_names) / sizeof(setup_names[0]))
+#define SETUP_BATCH "flow-rate-lpm=10;ratio-of-A-to-B-%=40;ph-dose-time-s=5;ec-setpoint=1.5;ph-setpoint=6.2;" \
+                    "closed-loop=false;ec-dose=false"
+
+static void control_topic(Dosa_Cls *dosa, const char *name, char *topic) {
+    dosa->get_commission_path_str(topic);
+    strcat(topic, "control/");
+    strcat(topic, name);
+}
+
+// mean ns for one whole setup through process_message(), the payloads are copied in each time as the
+// bridge hands over a fresh buffer and the batch is split in place
+static double run_setup(Dosa_Cls *dosa, unsigned long setups, bool batch) {
+    char topics[SETUP_TOPICS][MAX_PATH_LENGTH];
+    char batch_topic[MAX_PATH_LENGTH];
+    for (size_t i = 0; i < SETUP_TOPICS; i++) {
+        control_topic(dosa, setup_names[i], topics[i]);
+    }
+    control_topic(dosa, "batch", batch_topic);
+
+    char payload[sizeof(SETUP_BATCH)];
+    unsigned long taken = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long setup = 0; setup < setups; setup++) {
+        if (batch) {
+            memcpy(payload, SETUP_BATCH, sizeof(SETUP_BATCH));
+            taken += dosa->process_message(batch_topic, payload);
+        } else {
+            for (size_t i = 0; i < SETUP_TOPICS; i++) {
+                strcpy(payload, setup_values[i]);
+                taken += dosa->process_message(topics[i], payload);
+            }
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (taken != setups * (batch ? 1 : SETUP_TOPICS)) {
+        fprintf(stderr, "%s setup rejected\n", batch ? "batch" : "per-topic");
+        exit(1);
+    }
+    return ns / setups;
+}
+
+// the control topics process_message() matched one after another before the topic table, in that order
+static const char *const chain_names[] = {
+    "flow-rate-lpm", "ratio-of-A-to-B-%", "ec-dose", "ph-dose", "run-mixture", "ph-dose-time-s", "dose-lockout",
+};
+static const char *const chain_values[] = {"10", "40", "false", "false", "false", "5", "false"};
+#define CHAIN_TOPICS (sizeof(chain_names) / sizeof(chain_names[0]))
+
+// the old dispatch: module messages, then a flash copy and full path compare per topic until one matches
+static bool chain_match(Dosa_Cls *dosa, char *topic, char *payload) {
+    if (dosa->process_module_messages(topic, payload)) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/flow-rate-lpm")))) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/ratio-of-A-to-B-%")))) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/ec-dose")))) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/ph-dose")))) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/run-mixture")))) {
+        return true;
+    }
+    if (dosa->topic_main_path_match(topic, FStr(F("control/ph-dose-time-s")))) {
+        return true;
+    }
+    return dosa->topic_main_path_match(topic, FStr(F("control/dose-lockout")));
+}
+
+// how run_messages() hands a message over
+enum message_path {message_table, message_chain, message_dispatch};
+
+/*
+    Messages a second spread over the heads and the control topics in turn. The table and chain paths offer
+    every message to every head, the dispatch path makes the one Dosa_Cls::dispatch() call the bridge makes.
+    The chain only finds the topic, the table and dispatch also parse and apply it.
+*/
+static double run_messages(uint8_t heads, unsigned long messages, message_path path) {
+    rig_reset();
+    Dosa_Cls *dosas[DOSA_MAX_INSTANCES];
+    char topics[DOSA_MAX_INSTANCES][CHAIN_TOPICS][MAX_PATH_LENGTH];
+    for (uint8_t i = 0; i < heads; i++) {
+        dosas[i] = rig_start();
+        for (size_t j = 0; j < CHAIN_TOPICS; j++) {
+            control_topic(dosas[i], chain_names[j], topics[i][j]);
+        }
+    }
+
+    char payload[8];
+    unsigned long taken = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long message = 0; message < messages; message++) {
+        uint8_t head = message % heads;
+        size_t topic = (message / heads) % CHAIN_TOPICS;
+        if (path == message_dispatch) {
+            strcpy(payload, chain_values[topic]);
+            taken += Dosa_Cls::dispatch(topics[head][topic], payload);
+            continue;
+        }
+        for (uint8_t i = 0; i < heads; i++) {
+            strcpy(payload, chain_values[topic]);
+            taken += path == message_chain ? chain_match(dosas[i], topics[head][topic], payload)
+                                           : dosas[i]->process_message(topics[head][topic], payload);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (uint8_t i = 0; i < heads; i++) {
+        delete dosas[i];
+    }
+    if (taken != messages) {
+        fprintf(stderr, "%lu of %lu messages taken by %u heads\n", taken, messages, heads);
+        exit(1);
+    }
+    return messages / seconds;
+}
+
+// calculate_ec_ratio() before fixed point, from the float control values as they arrived
+static void float_dose_window(float dose_amount_l, float flow_rate, float ratio_of_A_to_B, unsigned long &A_ms,
+                              unsigned long &B_ms) {
+    if (ratio_of_A_to_B >= 100) {
+        ratio_of_A_to_B = 100;
+    }
+    if (ratio_of_A_to_B <= 0) {
+        ratio_of_A_to_B = 0;
+    }
+    float total_valve_on_time = dose_amount_l / flow_rate;
+    float A_ratio_as_decimal = ratio_of_A_to_B / 100.0;
+    float b_ratio_as_decimal = (100 - ratio_of_A_to_B) / 100.0;
+    A_ms = ((A_ratio_as_decimal * total_valve_on_time) * 60.0) * 1000;
+    B_ms = ((b_ratio_as_decimal * total_valve_on_time) * 60.0) * 1000;
+}
+
+// calculate_ec_ratio() now, from the fixed point values process_message() stores
+static void fixed_dose_window(float dose_amount_l, uint32_t flow_rate_mlpm, uint16_t ratio_of_A_to_B_centi,
+                              unsigned long &A_ms, unsigned long &B_ms) {
+    uint32_t dose_amount_ml = (uint32_t)(dose_amount_l * 1000 + 0.5);
+    uint32_t half = flow_rate_mlpm / 2;
+    unsigned long total_ms = (uint32_t)(((uint64_t)dose_amount_ml * 60000UL + half) / flow_rate_mlpm);
+    A_ms = (uint32_t)(((uint64_t)dose_amount_ml * 6UL * ratio_of_A_to_B_centi + half) / flow_rate_mlpm);
+    B_ms = total_ms - A_ms;
+}
+
+#define WINDOW_DOSES 8
+#define WINDOW_FLOWS 8
+#define WINDOW_RATIOS 11
+
+/*
+    Mean cycles and ns for one dose window over a grid of 0.05 - 5 l doses, 0.5 - 30 l/min and 0 - 100 % A,
+    the float formula against the fixed point one, and the most the two differ by in ms. Host float is
+    hardware float, on AVR the float path is soft float and the gap is wider.
+*/
+static void run_dose_windows(unsigned long rounds) {
+    static const float doses_l[WINDOW_DOSES] = {0.05, 0.1, 0.25, 0.5, 1, 2, 3.3, 5};
+    static const float flows_lpm[WINDOW_FLOWS] = {0.5, 1, 2.5, 5, 7.5, 10, 17, 30};
+    float ratios[WINDOW_RATIOS];
+    uint32_t flows_mlpm[WINDOW_FLOWS];
+    uint16_t ratios_centi[WINDOW_RATIOS];
+    for (uint8_t i = 0; i < WINDOW_RATIOS; i++) {
+        ratios[i] = i * 10.0;
+        ratios_centi[i] = (uint16_t)(ratios[i] * 100 + 0.5);
+    }
+    for (uint8_t i = 0; i < WINDOW_FLOWS; i++) {
+        flows_mlpm[i] = (uint32_t)(flows_lpm[i] * 1000 + 0.5);
+    }
+
+    // the most A or B differ by between the two, in ms
+    long max_diff_ms = 0;
+    for (uint8_t d = 0; d < WINDOW_DOSES; d++) {
+        for (uint8_t f = 0; f < WINDOW_FLOWS; f++) {
+            for (uint8_t r = 0; r < WINDOW_RATIOS; r++) {
+                unsigned long float_A, float_B, fixed_A, fixed_B;
+                float_dose_window(doses_l[d], flows_lpm[f], ratios[r], float_A, float_B);
+                fixed_dose_window(doses_l[d], flows_mlpm[f], ratios_centi[r], fixed_A, fixed_B);
+                long diff_A = labs((long)float_A - (long)fixed_A);
+                long diff_B = labs((long)float_B - (long)fixed_B);
+                max_diff_ms = diff_A > max_diff_ms ? diff_A : max_diff_ms;
+                max_diff_ms = diff_B > max_diff_ms ? diff_B : max_diff_ms;
+            }
+        }
+    }
+
+    for (uint8_t fixed = 0; fixed < 2; fixed++) {
+        volatile unsigned long sink = 0;
+        unsigned long calls = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        unsigned long long cycles = BENCH_CYCLES();
+        for (unsigned long round = 0; round < rounds; round++) {
+            for (uint8_t d = 0; d < WINDOW_DOSES; d++) {
+                for (uint8_t f = 0; f < WINDOW_FLOWS; f++) {
+                    for (uint8_t r = 0; r < WINDOW_RATIOS; r++) {
+                        unsigned long A_ms;
+                        unsigned long B_ms;
+                        if (fixed) {
+                            fixed_dose_window(doses_l[d], flows_mlpm[f], ratios_centi[r], A_ms, B_ms);
+                        } else {
+                            float_dose_window(doses_l[d], flows_lpm[f], ratios[r], A_ms, B_ms);
+                        }
+                        sink = sink + A_ms + B_ms;
+                        calls++;
+                    }
+                }
+            }
+        }
+        cycles = BENCH_CYCLES() - cycles;
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        printf("%-14s %10lu %12.1f %14.1f", fixed ? "fixed point" : "float", calls, ns / calls,
+               (double)cycles / calls);
+        if (fixed) {
+            printf(" %12ld\n", max_diff_ms);
+        } else {
+            printf(" %12s\n", "-");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long ticks = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    if (ticks == 0) {
+        fprintf(stderr, "usage: %s [ticks per scenario]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-14s %10s %12s %12s %14s %12s %12s\n", "scenario", "ticks", "mean ns", "max ns", "mean cycles",
+           "publishes", "pin writes");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        Dosa_Cls *dosa = bench_doser();
+        Bench_Result result = run_scenario(dosa, ticks, scenarios[i].step);
+        printf("%-14s %10lu %12.1f %12.1f %14.1f %12lu %12lu\n", scenarios[i].name, ticks, result.mean_ns,
+               result.max_ns, result.mean_cycles, result.publishes, result.pin_writes);
+#ifdef DOSA_PROFILE
+        print_perf_report(dosa);
+#endif
+        delete dosa;
+    }
+
+    // the SRAM column is the host object size, the AVR one is checked against DOSA_RAM_BUDGET by the build
+    printf("\n%-14s %10s %12s %12s %14s\n", "heads", "ticks", "loop ns", "ns per head", "host bytes");
+    for (uint8_t heads = 1; heads <= DOSA_MAX_INSTANCES; heads *= 2) {
+        double loop_ns = run_heads(heads, ticks);
+        printf("%-14u %10lu %12.1f %12.1f %14lu\n", heads, ticks, loop_ns, loop_ns / heads,
+               (unsigned long)(heads * sizeof(Dosa_Cls)));
+    }
+
+    printf("\n%-14s %10s %12s %12s %14s\n", "heads", "messages", "table msg/s", "chain msg/s", "dispatch msg/s");
+    for (uint8_t heads = 1; heads <= DOSA_MAX_INSTANCES; heads *= 2) {
+        double table = run_messages(heads, ticks, message_table);
+        double chain = run_messages(heads, ticks, message_chain);
+        double dispatch = run_messages(heads, ticks, message_dispatch);
+        printf("%-14u %10lu %12.0f %12.0f %14.0f\n", heads, ticks, table, chain, dispatch);
+    }
+
+    printf("\n%-14s %10s %12s %12s %14s\n", "control setup", "setups", "ns", "messages", "setups per s");
+    for (uint8_t batch = 0; batch < 2; batch++) {
+        Dosa_Cls *dosa = bench_doser();
+        double ns = run_setup(dosa, ticks, batch);
+        printf("%-14s %10lu %12.1f %12u %14.0f\n", batch ? "batch" : "per-topic", ticks, ns,
+               batch ? 1 : (unsigned)SETUP_TOPICS, 1e9 / ns);
+        delete dosa;
+    }
+
+    printf("\n%-14s %10s %12s %14s %12s\n", "dose window", "calls", "ns", "cycles", "ms apart");
+    run_dose_windows(ticks / (WINDOW_DOSES * WINDOW_FLOWS * WINDOW_RATIOS) + 1);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include <decode.h>
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+size_t decode_hex(const char *hex, uint8_t *data, size_t size) {
+    size_t length = strlen(hex);
+    if (length % 2 != 0 || length / 2 > size) {
+        return 0;
+    }
+    for (size_t i = 0; i < length / 2; i++) {
+        int high = hex_digit(hex[i * 2]);
+        int low = hex_digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return 0;
+        }
+        data[i] = high << 4 | low;
+    }
+    return length / 2;
+}
+
+// little endian, as the doser writes them
+static uint32_t get_le(const uint8_t *pos, uint8_t size) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        value |= (uint32_t)pos[i] << (8 * i);
+    }
+    return value;
+}
+
+bool decode_event_batch(const char *hex, Event_Batch &batch) {
+    uint8_t data[EVENT_HEADER_LENGTH + EVENT_BATCH * EVENT_RECORD_LENGTH];
+    size_t length = decode_hex(hex, data, sizeof(data));
+    if (length < EVENT_HEADER_LENGTH || data[0] != EVENT_LOG_VERSION) {
+        return false;
+    }
+    batch.version = data[0];
+    batch.sequence = get_le(data + 1, 4);
+    batch.count = data[5];
+    batch.age_ms = get_le(data + 6, 4);
+    if (batch.count > EVENT_BATCH || length != (size_t)(EVENT_HEADER_LENGTH + batch.count * EVENT_RECORD_LENGTH)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < batch.count; i++) {
+        const uint8_t *record = data + EVENT_HEADER_LENGTH + i * EVENT_RECORD_LENGTH;
+        batch.records[i].delta_ds = get_le(record, 2);
+        batch.records[i].type = record[2] & 0x0f;
+        batch.records[i].cause = record[2] >> 4;
+        batch.records[i].channel = record[3];
+        batch.records[i].duration_ms = get_le(record + 4, 4);
+    }
+    return true;
+}
+
+static float get_float(const uint8_t *pos) {
+    uint32_t bits = get_le(pos, 4);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool decode_status_frame(const char *hex, Status_Frame &frame) {
+    uint8_t data[STATUS_FRAME_LENGTH];
+    if (decode_hex(hex, data, sizeof(data)) != STATUS_FRAME_LENGTH || data[0] != STATUS_FRAME_VERSION) {
+        return false;
+    }
+    frame.version = data[0];
+    frame.ec_dose = data[1] & 1;
+    frame.ph_dose = data[1] & 2;
+    frame.run_mixture = data[1] & 4;
+    frame.dose_lockout = data[1] & 8;
+    frame.ph_valve = data[2] & 1;
+    frame.mixture_valve = data[2] & 2;
+    frame.nutrient_A_valve = data[2] & 4;
+    frame.nutrient_B_valve = data[2] & 8;
+    frame.lockout_control = data[3] & 1;
+    frame.lockout_ec = data[3] & 2;
+    frame.lockout_ph = data[3] & 4;
+    frame.emergency_stop = data[3] & 8;
+    frame.lockout_type = data[4];
+    frame.ph_pin = (int16_t)get_le(data + 5, 2);
+    frame.mixture_pin = (int16_t)get_le(data + 7, 2);
+    frame.nutrient_A_pin = (int16_t)get_le(data + 9, 2);
+    frame.nutrient_B_pin = (int16_t)get_le(data + 11, 2);
+    frame.emergency_stop_pin = (int16_t)get_le(data + 13, 2);
+    frame.flow_rate_lpm = get_float(data + 15);
+    frame.ratio_of_A_to_B = get_float(data + 19);
+    frame.ph_dose_time_s = (int32_t)get_le(data + 23, 4);
+    frame.nutrient_A_time_ms = get_float(data + 27);
+    frame.nutrient_B_time_ms = get_float(data + 31);
+    frame.dose_amount_l = get_float(data + 35);
+    return true;
+}
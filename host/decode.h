@@ -0,0 +1,66 @@
+#ifndef HOST_DECODE_H
+#define HOST_DECODE_H
+
+/*
+    Backend side decoders for the doser's binary payloads, so the tests check them the way a dashboard or
+    the backend would read them rather than against the firmware's own structs.
+*/
+
+#include <dosa.h>
+
+struct Event_Record {
+    unsigned long delta_ds;
+    uint8_t type;
+    uint8_t cause;
+    uint8_t channel;
+    uint32_t duration_ms;
+};
+
+// one status/events payload, see the event log layout in dosa.h
+struct Event_Batch {
+    uint8_t version;
+    uint32_t sequence;
+    uint8_t count;
+    uint32_t age_ms;
+    Event_Record records[EVENT_BATCH];
+};
+
+// one status/frame payload, see the status frame layout in dosa.h
+struct Status_Frame {
+    uint8_t version;
+    bool ec_dose;
+    bool ph_dose;
+    bool run_mixture;
+    bool dose_lockout;
+    bool ph_valve;
+    bool mixture_valve;
+    bool nutrient_A_valve;
+    bool nutrient_B_valve;
+    bool lockout_control;
+    bool lockout_ec;
+    bool lockout_ph;
+    bool emergency_stop;
+    uint8_t lockout_type;
+    short ph_pin;
+    short mixture_pin;
+    short nutrient_A_pin;
+    short nutrient_B_pin;
+    short emergency_stop_pin;
+    float flow_rate_lpm;
+    float ratio_of_A_to_B;
+    long ph_dose_time_s;
+    float nutrient_A_time_ms;
+    float nutrient_B_time_ms;
+    float dose_amount_l;
+};
+
+// hex into data, the number of bytes or 0 if the text is not whole bytes of hex or does not fit
+size_t decode_hex(const char *hex, uint8_t *data, size_t size);
+
+// false if the payload is malformed, another version or its length does not match its count
+bool decode_event_batch(const char *hex, Event_Batch &batch);
+
+// false if the payload is malformed, another version or not STATUS_FRAME_LENGTH bytes
+bool decode_status_frame(const char *hex, Status_Frame &frame);
+
+#endif
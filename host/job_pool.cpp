@@ -0,0 +1,71 @@
+#include <thread>
+
+#include <job_pool.h>
+
+Job_Pool_Cls::Job_Pool_Cls(unsigned workers) {
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+    }
+    this->worker_count = workers > 0 ? workers : 1;
+    this->queues = std::vector<Job_Queue>(this->worker_count);
+    this->steal_count = 0;
+}
+
+unsigned Job_Pool_Cls::workers() {
+    return this->worker_count;
+}
+
+unsigned long Job_Pool_Cls::steals() {
+    return this->steal_count;
+}
+
+void Job_Pool_Cls::run(size_t count, Job_Fn job, void *context) {
+    this->steal_count = 0;
+    for (unsigned i = 0; i < this->worker_count; i++) {
+        size_t first = count * i / this->worker_count;
+        size_t last = count * (i + 1) / this->worker_count;
+        for (size_t index = first; index < last; index++) {
+            this->queues[i].jobs.push_back(index);
+        }
+    }
+
+    // the calling thread is worker 0
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < this->worker_count; i++) {
+        threads.push_back(std::thread(&Job_Pool_Cls::work, this, i, job, context));
+    }
+    this->work(0, job, context);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+bool Job_Pool_Cls::take(unsigned worker, size_t &index) {
+    {
+        std::lock_guard<std::mutex> guard(this->queues[worker].lock);
+        if (!this->queues[worker].jobs.empty()) {
+            index = this->queues[worker].jobs.back();
+            this->queues[worker].jobs.pop_back();
+            return true;
+        }
+    }
+    // nothing is added once run() has started, so a pass that finds every run empty means the sweep is done
+    for (unsigned i = 1; i < this->worker_count; i++) {
+        Job_Queue &victim = this->queues[(worker + i) % this->worker_count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            index = victim.jobs.front();
+            victim.jobs.pop_front();
+            this->steal_count++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Job_Pool_Cls::work(unsigned worker, Job_Fn job, void *context) {
+    size_t index;
+    while (this->take(worker, index)) {
+        job(index, worker, context);
+    }
+}
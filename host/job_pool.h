@@ -0,0 +1,47 @@
+#ifndef HOST_JOB_POOL_H
+#define HOST_JOB_POOL_H
+
+/*
+    Work stealing thread pool for the parameter sweep. Jobs are numbered from 0 and dealt out in equal runs,
+    one run per worker. A worker takes its own jobs from the back of its run and, once that is empty, steals
+    from the front of the next worker's run that still has any, so a run of long sessions is shared out
+    instead of holding up the sweep. Every job touching only its own index is all the locking a job needs.
+*/
+
+#include <stddef.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+typedef void (*Job_Fn)(size_t index, unsigned worker, void *context);
+
+class Job_Pool_Cls {
+
+  public:
+
+    // zero workers is one per core
+    Job_Pool_Cls(unsigned workers);
+    unsigned workers();
+    // run job for every index below count, returns once they have all run
+    void run(size_t count, Job_Fn job, void *context);
+    // jobs taken from another worker's run in the last run()
+    unsigned long steals();
+
+  private:
+
+    struct Job_Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    unsigned worker_count;
+    std::vector<Job_Queue> queues;
+    std::atomic<unsigned long> steal_count;
+
+    bool take(unsigned worker, size_t &index);
+    void work(unsigned worker, Job_Fn job, void *context);
+};
+
+#endif
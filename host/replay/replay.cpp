@@ -0,0 +1,57 @@
+/*
+    Replays a trace dumped by a DOSA_TRACE build, from status/trace or the serial port, one
+    "<millis>,<kind>,<topic or pin>,<value>" line per record, anything else on a line is skipped. Prints
+    every output the replay and the trace disagree on and exits 1 if there are any, so a trace from the
+    field can bisect a behaviour change. The replay runs the number of times asked for to give its speed
+    against real time.
+
+        dosa_replay [trace file, - for stdin] [runs]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include <trace_replay.h>
+
+int main(int argc, char **argv) {
+    FILE *in = argc > 1 && strcmp(argv[1], "-") != 0 ? fopen(argv[1], "r") : stdin;
+    unsigned runs = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+    if (in == NULL || runs == 0) {
+        fprintf(stderr, "usage: %s [trace file, - for stdin] [runs]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Replay_Record> trace;
+    char line[256];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        Replay_Record record;
+        if (parse_trace_line(line, record)) {
+            trace.push_back(record);
+        }
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (trace.empty()) {
+        fprintf(stderr, "no trace records\n");
+        return 2;
+    }
+
+    Replay_Result result = replay_trace(trace, stdout);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned run = 1; run < runs; run++) {
+        replay_trace(trace, NULL);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%zu records, %zu inputs, %zu traced outputs, %zu replayed, %zu mismatches\n", trace.size(),
+           result.inputs, result.outputs, result.replayed, result.mismatches);
+    if (runs > 1) {
+        printf("%u runs of %.1f s virtual in %.3f s, %.0fx real time\n", runs - 1, result.virtual_ms / 1000.0,
+               seconds, (runs - 1) * result.virtual_ms / 1000.0 / seconds);
+    }
+    return result.mismatches > 0 ? 1 : 0;
+}
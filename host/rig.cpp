@@ -0,0 +1,98 @@
+#include <eeprom_writer.h>
+#include <rig.h>
+#include <utils.h>
+
+// the dosa registries and shared state, reset here so each doser a test builds starts at instance 0
+extern DOSA_GLOBAL int dosa_instance_count;
+extern DOSA_GLOBAL uint8_t emergency_stop_instance_count;
+extern DOSA_GLOBAL uint8_t flow_sensor_count;
+extern DOSA_GLOBAL Eeprom_Writer_Cls eeprom_writer;
+extern DOSA_GLOBAL Dosa_Clock dosa_clock;
+
+thread_local Bridge_Device_Cls rig_device;
+
+static void reset_registries() {
+    dosa_instance_count = 0;
+    emergency_stop_instance_count = 0;
+    flow_sensor_count = 0;
+    // a record still in flight belongs to a doser that is gone, as it would be after a reset
+    eeprom_writer = Eeprom_Writer_Cls();
+    dosa_clock = Dosa_Clock();
+    rig_device = Bridge_Device_Cls();
+}
+
+void rig_reset() {
+    host_reset();
+    reset_registries();
+}
+
+void rig_restart() {
+    host_restart();
+    reset_registries();
+}
+
+Dosa_Cls *rig_doser() {
+    Dosa_Cls *dosa = new Dosa_Cls();
+    dosa->device = &rig_device;
+    dosa->commissioned = true;
+    dosa->newly_commissioned = false;
+    dosa->nutrient_A_valve_pin = RIG_NUTRIENT_A_PIN;
+    dosa->nutrient_B_valve_pin = RIG_NUTRIENT_B_PIN;
+    dosa->ph_valve_pin = RIG_PH_PIN;
+    dosa->mixture_valve_pin = RIG_MIXTURE_PIN;
+    dosa->lockout_led_pin = RIG_LOCKOUT_LED_PIN;
+    dosa->emergency_stop_pin = RIG_EMERGENCY_STOP_PIN;
+    dosa->dose_amount_l = 1;
+    return dosa;
+}
+
+Dosa_Cls *rig_start() {
+    Dosa_Cls *dosa = rig_doser();
+    dosa->init();
+    // init() writes the e-stop pin low before making it an input, the button is released
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    return dosa;
+}
+
+bool rig_control(Dosa_Cls *dosa, const char *name, const char *payload) {
+    char topic[MAX_PATH_LENGTH];
+    char value[256];
+    dosa->get_commission_path_str(topic);
+    strcat(topic, "control/");
+    strcat(topic, name);
+    strncpy(value, payload, sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    return dosa->process_message(topic, value);
+}
+
+void rig_run(Dosa_Cls *dosa, unsigned long ms) {
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+    }
+}
+
+unsigned long rig_high_ms(uint8_t pin, unsigned long from_ms, unsigned long to_ms) {
+    unsigned long total = 0;
+    bool high = false;
+    unsigned long since = from_ms;
+    for (size_t i = 0; i < host_pin_writes.size(); i++) {
+        const Host_Pin_Write &write = host_pin_writes[i];
+        if (write.pin != pin || write.ms > to_ms) {
+            continue;
+        }
+        unsigned long at = write.ms < from_ms ? from_ms : write.ms;
+        if (high && !write.state) {
+            total += at - since;
+        }
+        if (!high && write.state) {
+            since = at;
+        }
+        high = write.state;
+    }
+    if (high) {
+        total += to_ms - since;
+    }
+    return total;
+}
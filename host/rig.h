@@ -0,0 +1,44 @@
+#ifndef HOST_RIG_H
+#define HOST_RIG_H
+
+/*
+    A doser wired the way the bench sketch wires it, for the benchmarks and tests. rig_reset() puts the
+    stand-ins and the dosa globals back to power on, so one process can build several dosers in turn.
+*/
+
+#include <bridge_device.h>
+#include <dosa.h>
+#include <host.h>
+
+#define RIG_NUTRIENT_A_PIN 2
+#define RIG_NUTRIENT_B_PIN 3
+#define RIG_PH_PIN 4
+#define RIG_MIXTURE_PIN 5
+#define RIG_LOCKOUT_LED_PIN 7
+#define RIG_EMERGENCY_STOP_PIN 18
+#define RIG_NUTRIENT_A_FLOW_PIN 19
+#define RIG_NUTRIENT_B_FLOW_PIN 20
+#define RIG_TICK_MS 10
+
+extern thread_local Bridge_Device_Cls rig_device;
+
+void rig_reset();
+// rig_reset() keeping the EEPROM, the doser rebooting
+void rig_restart();
+
+// a commissioned doser on the rig pins with the e-stop released, init() not yet run so a test can change
+// the configuration first
+Dosa_Cls *rig_doser();
+// rig_doser() and init()
+Dosa_Cls *rig_start();
+
+// deliver "<mac>/<instance>/dosa/control/<name>" the way the bridge would, true if the doser took it
+bool rig_control(Dosa_Cls *dosa, const char *name, const char *payload);
+
+// run main() every RIG_TICK_MS for ms of virtual time
+void rig_run(Dosa_Cls *dosa, unsigned long ms);
+
+// total ms a pin spent high between two times, from the recorded writes
+unsigned long rig_high_ms(uint8_t pin, unsigned long from_ms, unsigned long to_ms);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+    Host stand-in for the parts of the Arduino core the dosa sources use. Flash strings are plain strings,
+    the clock is virtual and pin, interrupt and serial calls are recorded by host.cpp, see host.h.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define NOT_AN_INTERRUPT -1
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define strstr_P strstr
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_ptr(address) (*(void *const *)(address))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+unsigned long millis();
+unsigned long micros();
+// host only, a real monotonic clock in ns for the profile build's stage timings
+unsigned long host_clock_ns();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+void noInterrupts();
+void interrupts();
+
+#ifdef __AVR__
+// only defined by targets that build the port register path against host_ports, eight pins per port
+extern thread_local volatile uint8_t host_ports[];
+#define digitalPinToPort(pin) ((pin) / 8)
+#define portOutputRegister(port) (&host_ports[port])
+#define digitalPinToBitMask(pin) (1 << ((pin) % 8))
+#endif
+
+char *utoa(unsigned int value, char *buffer, int radix);
+char *ltoa(long value, char *buffer, int radix);
+char *ultoa(unsigned long value, char *buffer, int radix);
+
+class Stream {
+
+  public:
+
+    virtual int available();
+    virtual int read();
+    virtual size_t write(uint8_t value);
+    size_t write(const uint8_t *buffer, size_t length);
+    virtual void flush();
+
+    void print(const char *text);
+    void print(const __FlashStringHelper *text);
+    void print(long value);
+    void println(const char *text);
+    void println(const __FlashStringHelper *text);
+    void println(long value);
+    void println();
+};
+
+class HardwareSerial : public Stream {
+
+  public:
+
+    void begin(unsigned long baud);
+};
+
+extern HardwareSerial Serial;
+
+#endif
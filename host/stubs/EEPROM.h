@@ -0,0 +1,42 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// the ATmega2560 on the Controllino Mega has 4 KiB of EEPROM
+#define HOST_EEPROM_SIZE 4096
+
+/*
+    Byte array EEPROM. Like the AVR library, put() and update() only write the bytes that change, and every
+    byte written is counted so a test can see how much a single main() tick would have blocked the loop.
+*/
+class EEPROMClass {
+
+  public:
+
+    uint8_t mem[HOST_EEPROM_SIZE];
+    unsigned long bytes_written;
+
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length();
+
+    template <typename T> T &get(int address, T &value) {
+        memcpy(&value, this->mem + address, sizeof(T));
+        return value;
+    }
+
+    template <typename T> const T &put(int address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            this->update(address + i, bytes[i]);
+        }
+        return value;
+    }
+};
+
+extern thread_local EEPROMClass EEPROM;
+
+#endif
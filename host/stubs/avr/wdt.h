@@ -0,0 +1,6 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+void wdt_reset();
+
+#endif
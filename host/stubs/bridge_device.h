@@ -0,0 +1,21 @@
+#ifndef HOST_BRIDGE_DEVICE_H
+#define HOST_BRIDGE_DEVICE_H
+
+#include <module.h>
+
+// host stand-in for the bridge device, set_pin() is recorded alongside digitalWrite()
+class Bridge_Device_Cls {
+
+  public:
+
+    uint8_t mac_address[6];
+    bool mqtt_connected;
+    bool new_control_connection;
+    bool new_mqtt_connection;
+
+    Bridge_Device_Cls();
+    void set_pin(short pin, bool state);
+    void add_module_to_list(Module_Cls *module);
+};
+
+#endif
@@ -0,0 +1,467 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/wdt.h>
+
+#include <chrono>
+
+#include <bridge_device.h>
+#include <host.h>
+#include <module.h>
+#include <utils.h>
+
+thread_local std::vector<Host_Pin_Write> host_pin_writes;
+thread_local std::vector<Host_Publish> host_publishes;
+
+static thread_local uint64_t host_us = 0;
+static thread_local int host_levels[HOST_PINS];
+static thread_local void (*host_isrs[HOST_PINS])(void);
+static thread_local int host_isr_modes[HOST_PINS];
+static thread_local int host_interrupt_lock = 0;
+static thread_local void (*host_read_hook)(uint8_t pin) = NULL;
+static thread_local void (*host_publish_hook)(const char *topic) = NULL;
+static thread_local bool host_recording = true;
+
+#ifdef __AVR__
+thread_local volatile uint8_t host_ports[HOST_PINS / 8 + 1];
+#endif
+
+HardwareSerial Serial;
+thread_local EEPROMClass EEPROM;
+
+void host_reset() {
+    host_restart();
+    memset(EEPROM.mem, 0xff, sizeof(EEPROM.mem));
+    EEPROM.bytes_written = 0;
+}
+
+void host_restart() {
+    host_us = 0;
+    memset(host_levels, 0, sizeof(host_levels));
+    memset(host_isrs, 0, sizeof(host_isrs));
+    host_interrupt_lock = 0;
+    host_read_hook = NULL;
+    host_publish_hook = NULL;
+    host_recording = true;
+#ifdef __AVR__
+    memset((void *)host_ports, 0, sizeof(host_ports));
+#endif
+    host_pin_writes.clear();
+    host_publishes.clear();
+}
+
+void host_set_millis(unsigned long ms) {
+    host_us = (uint64_t)ms * 1000;
+}
+
+void host_advance_ms(unsigned long ms) {
+    host_us += (uint64_t)ms * 1000;
+}
+
+void host_advance_us(unsigned long us) {
+    host_us += us;
+}
+
+int host_pin(uint8_t pin) {
+    return pin < HOST_PINS ? host_levels[pin] : 0;
+}
+
+void host_set_input(uint8_t pin, int level) {
+    if (pin < HOST_PINS) {
+        host_levels[pin] = level;
+    }
+}
+
+void host_drive_interrupt(uint8_t pin, int level) {
+    if (pin >= HOST_PINS) {
+        return;
+    }
+    int previous = host_levels[pin];
+    host_levels[pin] = level;
+    if (host_isrs[pin] == NULL || previous == level) {
+        return;
+    }
+    int mode = host_isr_modes[pin];
+    if (mode == CHANGE || (mode == FALLING && level == LOW) || (mode == RISING && level == HIGH)) {
+        host_isrs[pin]();
+    }
+}
+
+void host_fire_interrupt(uint8_t pin) {
+    if (pin < HOST_PINS && host_isrs[pin] != NULL) {
+        host_isrs[pin]();
+    }
+}
+
+bool host_interrupts_enabled() {
+    return host_interrupt_lock == 0;
+}
+
+void host_set_read_hook(void (*hook)(uint8_t pin)) {
+    host_read_hook = hook;
+}
+
+void host_set_publish_hook(void (*hook)(const char *topic)) {
+    host_publish_hook = hook;
+}
+
+void host_set_recording(bool record) {
+    host_recording = record;
+}
+
+const char *host_last_publish(const char *topic) {
+    for (size_t i = host_publishes.size(); i > 0; i--) {
+        if (host_publishes[i - 1].topic == topic) {
+            return host_publishes[i - 1].value.c_str();
+        }
+    }
+    return NULL;
+}
+
+unsigned long host_publish_count(const char *topic) {
+    unsigned long count = 0;
+    for (size_t i = 0; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic == topic) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void record_pin(uint8_t pin, bool state, host_pin_source source) {
+    if (pin >= HOST_PINS) {
+        return;
+    }
+    host_levels[pin] = state;
+    if (!host_recording) {
+        return;
+    }
+    Host_Pin_Write write = {millis(), pin, state, source};
+    host_pin_writes.push_back(write);
+}
+
+static void record_publish(char *sub_path, const char *value, bool retain) {
+    if (host_recording) {
+        Host_Publish publish = {millis(), sub_path, value, retain};
+        host_publishes.push_back(publish);
+    }
+    if (host_publish_hook != NULL) {
+        host_publish_hook(sub_path);
+    }
+}
+
+/*
+    Arduino core
+*/
+
+// both wrap where unsigned long does, at 2^32 as on the board in the long32 build
+unsigned long millis() {
+    return (unsigned long)(host_us / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)host_us;
+}
+
+unsigned long host_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    record_pin(pin, value != LOW, host_digital_write);
+}
+
+int digitalRead(uint8_t pin) {
+    int level = host_pin(pin);
+    if (host_read_hook != NULL) {
+        host_read_hook(pin);
+    }
+    return level;
+}
+
+int digitalPinToInterrupt(uint8_t pin) {
+    return pin < HOST_PINS ? pin : NOT_AN_INTERRUPT;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+    if (interrupt < HOST_PINS) {
+        host_isrs[interrupt] = isr;
+        host_isr_modes[interrupt] = mode;
+    }
+}
+
+void detachInterrupt(uint8_t interrupt) {
+    if (interrupt < HOST_PINS) {
+        host_isrs[interrupt] = NULL;
+    }
+}
+
+void noInterrupts() {
+    host_interrupt_lock++;
+}
+
+void interrupts() {
+    if (host_interrupt_lock > 0) {
+        host_interrupt_lock--;
+    }
+}
+
+void wdt_reset() {
+}
+
+char *utoa(unsigned int value, char *buffer, int radix) {
+    return ultoa(value, buffer, radix);
+}
+
+char *ltoa(long value, char *buffer, int radix) {
+    if (value < 0 && radix == 10) {
+        buffer[0] = '-';
+        ultoa(-(unsigned long)value, buffer + 1, radix);
+        return buffer;
+    }
+    return ultoa(value, buffer, radix);
+}
+
+char *ultoa(unsigned long value, char *buffer, int radix) {
+    char digits[sizeof(unsigned long) * 8 + 1];
+    uint8_t length = 0;
+    do {
+        uint8_t digit = value % radix;
+        digits[length++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= radix;
+    } while (value > 0);
+    for (uint8_t i = 0; i < length; i++) {
+        buffer[i] = digits[length - 1 - i];
+    }
+    buffer[length] = '\0';
+    return buffer;
+}
+
+int Stream::available() {
+    return 0;
+}
+
+int Stream::read() {
+    return -1;
+}
+
+size_t Stream::write(uint8_t) {
+    return 1;
+}
+
+size_t Stream::write(const uint8_t *buffer, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        this->write(buffer[i]);
+    }
+    return length;
+}
+
+void Stream::flush() {
+}
+
+// serial output is dropped, set HOST_SERIAL in the environment to see it
+static bool serial_echo() {
+    static const bool echo = getenv("HOST_SERIAL") != NULL;
+    return echo;
+}
+
+void Stream::print(const char *text) {
+    if (serial_echo()) {
+        fputs(text, stdout);
+    }
+}
+
+void Stream::print(const __FlashStringHelper *text) {
+    this->print((const char *)text);
+}
+
+void Stream::print(long value) {
+    if (serial_echo()) {
+        char text[24];
+        fputs(ltoa(value, text, 10), stdout);
+    }
+}
+
+void Stream::println(const char *text) {
+    this->print(text);
+    this->println();
+}
+
+void Stream::println(const __FlashStringHelper *text) {
+    this->println((const char *)text);
+}
+
+void Stream::println(long value) {
+    this->print(value);
+    this->println();
+}
+
+void Stream::println() {
+    this->print("\n");
+}
+
+void HardwareSerial::begin(unsigned long) {
+}
+
+/*
+    EEPROM
+*/
+
+uint8_t EEPROMClass::read(int address) {
+    return this->mem[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    this->mem[address] = value;
+    this->bytes_written++;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+    if (this->mem[address] != value) {
+        this->write(address, value);
+    }
+}
+
+uint16_t EEPROMClass::length() {
+    return HOST_EEPROM_SIZE;
+}
+
+/*
+    utils
+*/
+
+char *FStr(const __FlashStringHelper *text) {
+    // a few rotating buffers, the firmware passes at most a couple of these to one call
+    static thread_local char buffers[4][MAX_PATH_LENGTH];
+    static thread_local uint8_t next = 0;
+    next = (next + 1) % 4;
+    strncpy(buffers[next], (const char *)text, MAX_PATH_LENGTH - 1);
+    buffers[next][MAX_PATH_LENGTH - 1] = '\0';
+    return buffers[next];
+}
+
+void mac_str(char *buffer, uint8_t *mac_address) {
+    for (uint8_t i = 0; i < 6; i++) {
+        sprintf(buffer + i * 2, "%02x", mac_address[i]);
+    }
+}
+
+bool parse_float_from_string(char *text, float *value) {
+    char *end;
+    float parsed = strtof(text, &end);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+bool parse_bool_from_char(char *text, bool *value) {
+    if (strcmp(text, "1") == 0 || strcmp(text, "true") == 0) {
+        *value = true;
+        return true;
+    }
+    if (strcmp(text, "0") == 0 || strcmp(text, "false") == 0) {
+        *value = false;
+        return true;
+    }
+    return false;
+}
+
+bool parse_ul_from_string(char *text, long *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < 0) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+/*
+    bridge library
+*/
+
+Module_Cls::Module_Cls() {
+    this->device = NULL;
+    this->instance_number = 0;
+    this->commissioned = false;
+    this->newly_commissioned = false;
+    this->commission_publish_timer = 0;
+}
+
+bool Module_Cls::process_module_messages(char *, char *) {
+    return false;
+}
+
+bool Module_Cls::topic_main_path_match(char *topic, char *sub_path) {
+    char path[MAX_PATH_LENGTH];
+    this->get_commission_path_str(path);
+    size_t length = strlen(path);
+    return strncmp(topic, path, length) == 0 && strcmp(topic + length, sub_path) == 0;
+}
+
+void Module_Cls::publish_main(char *sub_path, char *value, bool retain, int) {
+    record_publish(sub_path, value, retain);
+}
+
+void Module_Cls::publish_main(char *sub_path, short value, bool retain, int) {
+    this->publish_main(sub_path, (long)value, retain, 1);
+}
+
+void Module_Cls::publish_main(char *sub_path, int value, bool retain, int) {
+    char text[24];
+    ltoa(value, text, 10);
+    record_publish(sub_path, text, retain);
+}
+
+#ifndef HOST_LONG32
+void Module_Cls::publish_main(char *sub_path, long value, bool retain, int) {
+    char text[24];
+    ltoa(value, text, 10);
+    record_publish(sub_path, text, retain);
+}
+#endif
+
+void Module_Cls::publish_main(char *sub_path, unsigned long value, bool retain, int) {
+    char text[24];
+    ultoa(value, text, 10);
+    record_publish(sub_path, text, retain);
+}
+
+void Module_Cls::publish_main(char *sub_path, float value, bool retain, int) {
+    // two decimals, as String(float) gives on the board
+    char text[24];
+    snprintf(text, sizeof(text), "%.2f", value);
+    record_publish(sub_path, text, retain);
+}
+
+void Module_Cls::publish_main(char *sub_path, bool value, bool retain, int) {
+    record_publish(sub_path, value ? "true" : "false", retain);
+}
+
+void Module_Cls::commissioning_subscribe() {
+}
+
+void Module_Cls::control_subscribe() {
+}
+
+void Module_Cls::publish_commissioning_type() {
+}
+
+Bridge_Device_Cls::Bridge_Device_Cls() {
+    memset(this->mac_address, 0, sizeof(this->mac_address));
+    this->mqtt_connected = true;
+    this->new_control_connection = false;
+    this->new_mqtt_connection = false;
+}
+
+void Bridge_Device_Cls::set_pin(short pin, bool state) {
+    record_pin(pin, state, host_set_pin);
+}
+
+void Bridge_Device_Cls::add_module_to_list(Module_Cls *) {
+}
@@ -0,0 +1,73 @@
+#ifndef HOST_H
+#define HOST_H
+
+/*
+    Control side of the host stand-ins. The clock only moves when a test or benchmark moves it, every pin
+    write and publish is recorded with the virtual time it happened at, and interrupts are fired by hand.
+    unsigned long is 64 bit on the host, so millis() does not roll over at 49 days here, except in the long32
+    build (stubs/long32.h) where it is 32 bit as on AVR. All of it is per thread, each thread is a board of
+    its own.
+*/
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+#define HOST_PINS 100
+
+enum host_pin_source {
+    host_digital_write,
+    host_set_pin,
+};
+
+struct Host_Pin_Write {
+    unsigned long ms;
+    uint8_t pin;
+    bool state;
+    host_pin_source source;
+};
+
+struct Host_Publish {
+    unsigned long ms;
+    std::string topic;                  // the sub path passed to publish_main()
+    std::string value;
+    bool retain;
+};
+
+extern thread_local std::vector<Host_Pin_Write> host_pin_writes;
+extern thread_local std::vector<Host_Publish> host_publishes;
+
+// back to power on: time 0, all pins low, nothing recorded, interrupts detached and the EEPROM erased
+void host_reset();
+// host_reset() that leaves the EEPROM alone, a reset or power cycle of the board
+void host_restart();
+
+void host_set_millis(unsigned long ms);
+void host_advance_ms(unsigned long ms);
+void host_advance_us(unsigned long us);
+
+// output level of a pin, or the level an input reads
+int host_pin(uint8_t pin);
+void host_set_input(uint8_t pin, int level);
+
+// drive an input to level and run its interrupt if the edge matches the attached mode
+void host_drive_interrupt(uint8_t pin, int level);
+// run a pin's attached interrupt directly, as if it fired now
+void host_fire_interrupt(uint8_t pin);
+// false between noInterrupts() and interrupts()
+bool host_interrupts_enabled();
+// called after every digitalRead() has its level, so a test can land an interrupt part way through a tick
+void host_set_read_hook(void (*hook)(uint8_t pin));
+// called after every publish is recorded, so a test can make the link slow or land an interrupt mid burst
+void host_set_publish_hook(void (*hook)(const char *topic));
+
+// false stops pin writes and publishes being recorded, pin levels still follow the writes. For the
+// allocation test, the records are host bookkeeping and allocate as they grow
+void host_set_recording(bool record);
+
+// last value published on a sub path, NULL if it was never published
+const char *host_last_publish(const char *topic);
+unsigned long host_publish_count(const char *topic);
+
+#endif
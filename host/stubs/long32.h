@@ -0,0 +1,25 @@
+#ifndef HOST_LONG32_H
+#define HOST_LONG32_H
+
+/*
+    Forced include (-include) of the long32 host build: long is 32 bit, as avr-gcc has it, so millis() and
+    every unsigned long timer in the firmware roll over at 2^32 the way they do on the board. The system
+    headers the host sources use are read first, with the real long, and the rest of the build sees int.
+    The long overloads of the stand-ins that would clash with the int ones are left out under HOST_LONG32.
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define HOST_LONG32
+#define long int
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HOST_MODULE_H
+#define HOST_MODULE_H
+
+#include <Arduino.h>
+
+class Bridge_Device_Cls;
+
+/*
+    Host stand-in for the bridge library module base class. Subscribes do nothing, publishes are recorded
+    in host_publishes and topic_main_path_match() compares against the module's own commission path.
+*/
+class Module_Cls {
+
+  public:
+
+    Bridge_Device_Cls *device;
+    int instance_number;
+    bool commissioned;
+    bool newly_commissioned;
+    unsigned long commission_publish_timer;
+
+    Module_Cls();
+    virtual ~Module_Cls() {}
+
+    virtual void init() = 0;
+    virtual void main() = 0;
+    virtual void publish_status() = 0;
+    virtual bool process_message(char *topic, char *payload) = 0;
+    virtual void get_commission_path_str(char *path) = 0;
+
+    bool process_module_messages(char *topic, char *payload);
+    bool topic_main_path_match(char *topic, char *sub_path);
+
+    void publish_main(char *sub_path, char *value, bool retain, int qos);
+    void publish_main(char *sub_path, short value, bool retain, int qos);
+    void publish_main(char *sub_path, int value, bool retain, int qos);
+#ifndef HOST_LONG32
+    void publish_main(char *sub_path, long value, bool retain, int qos);
+#endif
+    void publish_main(char *sub_path, unsigned long value, bool retain, int qos);
+    void publish_main(char *sub_path, float value, bool retain, int qos);
+    void publish_main(char *sub_path, bool value, bool retain, int qos);
+
+    void commissioning_subscribe();
+    void control_subscribe();
+    void publish_commissioning_type();
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_UTILS_H
+#define HOST_UTILS_H
+
+#include <Arduino.h>
+
+#define MAX_PATH_LENGTH 100
+
+char *FStr(const __FlashStringHelper *text);
+void mac_str(char *buffer, uint8_t *mac_address);
+bool parse_float_from_string(char *text, float *value);
+bool parse_bool_from_char(char *text, bool *value);
+bool parse_ul_from_string(char *text, long *value);
+
+#endif
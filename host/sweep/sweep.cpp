@@ -0,0 +1,231 @@
+/*
+    Parameter sweep for dose tuning. Every combination of the A:B ratio, pH dose time, dose amount, safety
+    timeout and EC split pulses below runs a number of simulated sessions against the tank model, each with its own
+    venturi draw, loop flow rate and sensor noise. A session is the README tuning run: 200 l of hard water
+    at EC 0.3 / pH 7.8, checked every 10 minutes and dosed while EC reads below or pH above its setpoint.
+    Prints time to setpoint, overshoot and safety lockout trips for each parameter set.
+
+        dosa_sweep [sessions per set] [threads] [seed]
+
+    A session's randomness only comes from the seed and its place in the sweep, so the same arguments give
+    the same table on any number of threads.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <job_pool.h>
+#include <rig.h>
+#include <tank.h>
+
+#define EC_SETPOINT 1.5
+#define PH_SETPOINT 6.2
+#define SETPOINT_BAND 0.05
+#define CHECK_INTERVAL_MS 600000UL
+#define SESSION_MS (4 * 3600000UL)
+#define SAMPLE_MS 60000UL
+
+// the README rig: 10 l/min round the loop, about 25 ml/s through the venturi at that flow
+#define NOMINAL_FLOW_LPM 10.0
+#define FLOW_SPREAD 0.15
+#define DRAW_MIN_ML_PER_S 18.0
+#define DRAW_MAX_ML_PER_S 30.0
+#define NOISE_MAX 0.03
+
+static const unsigned ratios_percent[] = {30, 50, 70};
+static const unsigned ph_dose_times_s[] = {2, 5, 10, 20};
+static const float dose_amounts_l[] = {1, 2, 5, 10};
+static const unsigned safety_timeouts_s[] = {20, 40, 60, 120};
+static const uint8_t ec_split_pulses[] = {1, 2, 4};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+#define PARAMETER_SETS (COUNT(ratios_percent) * COUNT(ph_dose_times_s) * COUNT(dose_amounts_l) * \
+                        COUNT(safety_timeouts_s) * COUNT(ec_split_pulses))
+
+struct Sweep_Set {
+    unsigned ratio_percent;
+    unsigned ph_dose_time_s;
+    float dose_amount_l;
+    unsigned safety_timeout_s;
+    uint8_t ec_split_pulses;
+};
+
+struct Session_Result {
+    bool reached;
+    unsigned long setpoint_ms;          // first sample with both EC and pH inside the band
+    double ec_overshoot;                // furthest EC went above its setpoint
+    double ph_overshoot;                // furthest pH went below its setpoint
+    bool lockout_ec;
+    bool lockout_ph;
+};
+
+struct Sweep {
+    unsigned sessions;
+    uint64_t seed;
+    std::vector<Session_Result> results;
+};
+
+static Sweep_Set sweep_set(size_t index) {
+    Sweep_Set set;
+    set.ec_split_pulses = ec_split_pulses[index % COUNT(ec_split_pulses)];
+    index /= COUNT(ec_split_pulses);
+    set.safety_timeout_s = safety_timeouts_s[index % COUNT(safety_timeouts_s)];
+    index /= COUNT(safety_timeouts_s);
+    set.dose_amount_l = dose_amounts_l[index % COUNT(dose_amounts_l)];
+    index /= COUNT(dose_amounts_l);
+    set.ph_dose_time_s = ph_dose_times_s[index % COUNT(ph_dose_times_s)];
+    index /= COUNT(ph_dose_times_s);
+    set.ratio_percent = ratios_percent[index];
+    return set;
+}
+
+// splitmix64, a session's stream is seeded from the sweep seed and the session's index alone
+static uint64_t next_random(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t &state, double low, double high) {
+    return low + (high - low) * (next_random(state) >> 11) / 9007199254740992.0;
+}
+
+static bool published_true(const char *topic) {
+    const char *value = host_last_publish(topic);
+    return value != NULL && strcmp(value, "true") == 0;
+}
+
+static void control(Dosa_Cls *dosa, const char *name, double value, const char *format) {
+    char payload[16];
+    snprintf(payload, sizeof(payload), format, value);
+    rig_control(dosa, name, payload);
+}
+
+static Session_Result run_session(const Sweep_Set &set, uint64_t seed) {
+    uint64_t random = seed;
+    double flow_lpm = NOMINAL_FLOW_LPM * uniform(random, 1 - FLOW_SPREAD, 1 + FLOW_SPREAD);
+
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->dose_amount_l = set.dose_amount_l;
+    dosa->safety_timout_limit_s = set.safety_timeout_s * 1000L;
+    dosa->ec_split_pulses = set.ec_split_pulses;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    control(dosa, "flow-rate-lpm", flow_lpm, "%.2f");
+    control(dosa, "ratio-of-A-to-B-%", set.ratio_percent, "%.0f");
+    control(dosa, "ph-dose-time-s", set.ph_dose_time_s, "%.0f");
+
+    // the venturi draws in proportion to the loop flow, so a slow loop doses the same volume over a
+    // longer valve time
+    Tank_Model_Cls tank;
+    tank.seed(next_random(random));
+    tank.draw_ml_per_s = uniform(random, DRAW_MIN_ML_PER_S, DRAW_MAX_ML_PER_S) * flow_lpm / NOMINAL_FLOW_LPM;
+    tank.ec_noise = uniform(random, 0, NOISE_MAX);
+    tank.ph_noise = uniform(random, 0, NOISE_MAX);
+
+    Session_Result result = {false, 0, 0, 0, false, false};
+    for (unsigned long elapsed = 0; elapsed < SESSION_MS; elapsed += SAMPLE_MS) {
+        if (elapsed % CHECK_INTERVAL_MS == 0) {
+            // the grower's check, on a reading as noisy as the doser's
+            if (tank.ec + uniform(random, -tank.ec_noise, tank.ec_noise) < EC_SETPOINT - SETPOINT_BAND) {
+                rig_control(dosa, "ec-dose", "true");
+            }
+            if (tank.ph + uniform(random, -tank.ph_noise, tank.ph_noise) > PH_SETPOINT + SETPOINT_BAND) {
+                rig_control(dosa, "ph-dose", "true");
+            }
+        }
+        tank.run(dosa, SAMPLE_MS);
+        if (!result.reached && fabs(tank.ec - EC_SETPOINT) <= SETPOINT_BAND &&
+            fabs(tank.ph - PH_SETPOINT) <= SETPOINT_BAND) {
+            result.reached = true;
+            result.setpoint_ms = elapsed + SAMPLE_MS;
+        }
+        result.ec_overshoot = fmax(result.ec_overshoot, tank.ec - EC_SETPOINT);
+        result.ph_overshoot = fmax(result.ph_overshoot, PH_SETPOINT - tank.ph);
+    }
+    result.lockout_ec = published_true("status/doser-safety-timer-lockout-ec");
+    result.lockout_ph = published_true("status/doser-safety-timer-lockout-ph");
+    delete dosa;
+    return result;
+}
+
+static void session_job(size_t index, unsigned, void *context) {
+    Sweep *sweep = (Sweep *)context;
+    uint64_t state = sweep->seed;
+    state = next_random(state) ^ index;
+    uint64_t seed = next_random(state);
+    sweep->results[index] = run_session(sweep_set(index / sweep->sessions), seed);
+}
+
+static void print_set(size_t set_index, const Session_Result *results, unsigned sessions) {
+    Sweep_Set set = sweep_set(set_index);
+    unsigned reached = 0;
+    unsigned lockouts_ec = 0;
+    unsigned lockouts_ph = 0;
+    double setpoint_total = 0;
+    unsigned long setpoint_max = 0;
+    double ec_total = 0;
+    double ec_max = 0;
+    double ph_total = 0;
+    double ph_max = 0;
+    for (unsigned i = 0; i < sessions; i++) {
+        const Session_Result &result = results[i];
+        if (result.reached) {
+            reached++;
+            setpoint_total += result.setpoint_ms;
+            if (result.setpoint_ms > setpoint_max) {
+                setpoint_max = result.setpoint_ms;
+            }
+        }
+        lockouts_ec += result.lockout_ec;
+        lockouts_ph += result.lockout_ph;
+        ec_total += result.ec_overshoot;
+        ec_max = fmax(ec_max, result.ec_overshoot);
+        ph_total += result.ph_overshoot;
+        ph_max = fmax(ph_max, result.ph_overshoot);
+    }
+    printf("%5u %5u %6.1f %6u %5u  %4u/%-4u", set.ratio_percent, set.ph_dose_time_s, set.dose_amount_l,
+           set.safety_timeout_s, set.ec_split_pulses, reached, sessions);
+    if (reached > 0) {
+        printf(" %7.1f %7.1f", setpoint_total / reached / 60000, setpoint_max / 60000.0);
+    } else {
+        printf(" %7s %7s", "-", "-");
+    }
+    printf("  %6.3f %6.3f  %6.3f %6.3f  %4u %4u\n", ec_total / sessions, ec_max, ph_total / sessions, ph_max,
+           lockouts_ec, lockouts_ph);
+}
+
+int main(int argc, char **argv) {
+    Sweep sweep;
+    sweep.sessions = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+    unsigned threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    sweep.seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    if (sweep.sessions == 0) {
+        sweep.sessions = 1;
+    }
+    sweep.results.resize(PARAMETER_SETS * sweep.sessions);
+
+    Job_Pool_Cls pool(threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pool.run(sweep.results.size(), session_job, &sweep);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("# %zu parameter sets x %u sessions, seed %llu, setpoint EC %.2f pH %.2f +-%.2f, times in minutes\n",
+           (size_t)PARAMETER_SETS, sweep.sessions, (unsigned long long)sweep.seed, EC_SETPOINT, PH_SETPOINT,
+           SETPOINT_BAND);
+    printf("%5s %5s %6s %6s %5s  %9s %7s %7s  %6s %6s  %6s %6s  %4s %4s\n", "A%", "ph_s", "dose_l", "safe_s",
+           "split", "reached", "t_mean", "t_max", "ec_avg", "ec_max", "ph_avg", "ph_max", "loEC", "loPH");
+    for (size_t i = 0; i < PARAMETER_SETS; i++) {
+        print_set(i, &sweep.results[i * sweep.sessions], sweep.sessions);
+    }
+    fprintf(stderr, "%zu sessions on %u threads in %.1f s, %lu stolen\n", sweep.results.size(), pool.workers(),
+            seconds, pool.steals());
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include <rig.h>
+#include <tank.h>
+
+Tank_Model_Cls::Tank_Model_Cls() {
+    // the README test: 200 l of hard water, 20 ml/s from the venturi, about a minute round the loop
+    this->ec = 0.3;
+    this->ph = 7.8;
+    this->draw_ml_per_s = 20;
+    this->ec_rise_per_ml = 0.0004;
+    this->ph_drop_per_ml = 0.0008;
+    this->mix_time_s = 60;
+    this->ec_uptake_per_h = 0;
+    this->ph_rise_per_h = 0;
+    this->ec_noise = 0;
+    this->ph_noise = 0;
+    this->report_ms = 10000;
+    this->ec_mixing = 0;
+    this->ph_mixing = 0;
+    this->random_state = 1;
+    this->last_report = 0;
+}
+
+void Tank_Model_Cls::seed(unsigned long seed) {
+    this->random_state = seed != 0 ? seed : 1;
+}
+
+double Tank_Model_Cls::noise(double peak) {
+    if (peak == 0) {
+        return 0;
+    }
+    // xorshift, so a seed gives the same run on every host
+    uint32_t x = this->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    this->random_state = x;
+    return peak * (2.0 * x / 4294967295.0 - 1);
+}
+
+void Tank_Model_Cls::step(unsigned long ms) {
+    double ml = this->draw_ml_per_s * ms / 1000;
+    if (host_pin(RIG_NUTRIENT_A_PIN)) {
+        this->ec_mixing += ml * this->ec_rise_per_ml;
+    }
+    if (host_pin(RIG_NUTRIENT_B_PIN)) {
+        this->ec_mixing += ml * this->ec_rise_per_ml;
+    }
+    if (host_pin(RIG_PH_PIN)) {
+        this->ph_mixing += ml * this->ph_drop_per_ml;
+    }
+
+    double k = ms / (this->mix_time_s * 1000);
+    this->ec += this->ec_mixing * k;
+    this->ec_mixing -= this->ec_mixing * k;
+    this->ph -= this->ph_mixing * k;
+    this->ph_mixing -= this->ph_mixing * k;
+
+    this->ec -= this->ec_uptake_per_h * ms / 3600000;
+    this->ph += this->ph_rise_per_h * ms / 3600000;
+}
+
+void Tank_Model_Cls::report(Dosa_Cls *dosa) {
+    char value[16];
+    snprintf(value, sizeof(value), "%.4f", this->ec + this->noise(this->ec_noise));
+    rig_control(dosa, "ec-reading", value);
+    snprintf(value, sizeof(value), "%.4f", this->ph + this->noise(this->ph_noise));
+    rig_control(dosa, "ph-reading", value);
+}
+
+void Tank_Model_Cls::run(Dosa_Cls *dosa, unsigned long ms) {
+    unsigned long start = millis();
+    while (millis() - start < ms) {
+        host_advance_ms(RIG_TICK_MS);
+        this->step(RIG_TICK_MS);
+        if (millis() - this->last_report >= this->report_ms) {
+            this->last_report = millis();
+            this->report(dosa);
+        }
+        dosa->main();
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef HOST_TANK_H
+#define HOST_TANK_H
+
+/*
+    Holding tank and dosing loop for the closed loop tests and the parameter sweep. Concentrate is drawn
+    while the rig valve pins are high, takes a first order mixing lag to reach the sensors, and the plants
+    pull EC down and pH up at a steady rate. report() hands the sensor readings to the doser the way the
+    EC / pH bridge does, on control/ec-reading and control/ph-reading.
+*/
+
+#include <dosa.h>
+
+class Tank_Model_Cls {
+
+  public:
+
+    double ec;
+    double ph;
+    double draw_ml_per_s;           // what the venturi really draws, the doser only has an estimate
+    double ec_rise_per_ml;
+    double ph_drop_per_ml;
+    double mix_time_s;              // time constant of the mixing lag
+    double ec_uptake_per_h;
+    double ph_rise_per_h;
+    double ec_noise;                // peak sensor noise, uniform
+    double ph_noise;
+    unsigned long report_ms;        // how often the readings are sent
+
+    Tank_Model_Cls();
+    // move the tank on by ms with the valves as the rig pins are now
+    void step(unsigned long ms);
+    void report(Dosa_Cls *dosa);
+    // run the doser and the tank together for ms, reporting readings every report_ms
+    void run(Dosa_Cls *dosa, unsigned long ms);
+    // a different noise sequence, for sweeps
+    void seed(unsigned long seed);
+
+  private:
+
+    double ec_mixing;               // dosed, not yet at the sensor
+    double ph_mixing;
+    uint32_t random_state;
+    unsigned long last_report;
+
+    double noise(double peak);
+};
+
+#endif
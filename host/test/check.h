@@ -0,0 +1,44 @@
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+/*
+    Just enough of a test framework for the host tests: CHECK() records a failure and carries on, so one
+    run shows every broken case, and check_result() is what main() returns to ctest.
+*/
+
+#include <math.h>
+#include <stdio.h>
+
+static unsigned check_count = 0;
+static unsigned check_failures = 0;
+
+#define CHECK(condition) check_that((condition), #condition, __FILE__, __LINE__)
+#define CHECK_NEAR(value, expected, tolerance)                                                          \
+    check_near((double)(value), (double)(expected), (double)(tolerance), #value, __FILE__, __LINE__)
+
+static inline bool check_that(bool passed, const char *text, const char *file, int line) {
+    check_count++;
+    if (!passed) {
+        check_failures++;
+        printf("%s:%d: CHECK(%s) failed\n", file, line, text);
+    }
+    return passed;
+}
+
+static inline bool check_near(double value, double expected, double tolerance, const char *text, const char *file,
+                              int line) {
+    check_count++;
+    if (fabs(value - expected) > tolerance) {
+        check_failures++;
+        printf("%s:%d: %s = %g, expected %g +/- %g\n", file, line, text, value, expected, tolerance);
+        return false;
+    }
+    return true;
+}
+
+static inline int check_result() {
+    printf("%u checks, %u failed\n", check_count, check_failures);
+    return check_failures == 0 ? 0 : 1;
+}
+
+#endif
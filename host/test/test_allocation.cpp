@@ -0,0 +1,127 @@
+/*
+    No heap in the hot path: a whole dosing cycle through main() and process_message(), with a reconnect
+    burst, a batch, a lockout and an e-stop press in it, makes no malloc, calloc, realloc or new call. The
+    C allocators are wrapped at link time (--wrap, see CMakeLists.txt), operator new is replaced here.
+*/
+
+#include <new>
+
+#include <check.h>
+#include <rig.h>
+
+static bool counting = false;
+static unsigned long allocations = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations += counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations += counting;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    allocations += counting;
+    return __real_realloc(pointer, size);
+}
+}
+
+void *operator new(size_t size) {
+    allocations += counting;
+    void *pointer = __real_malloc(size > 0 ? size : 1);
+    if (pointer == NULL) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+static bool A_opened = false;
+static bool ph_opened = false;
+
+static void run_watching(Dosa_Cls *dosa, unsigned long ms) {
+    unsigned long end = millis() + ms;
+    while (millis() < end) {
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+        A_opened |= host_pin(RIG_NUTRIENT_A_PIN);
+        ph_opened |= host_pin(RIG_PH_PIN);
+    }
+}
+
+static void dosing_cycle_allocates_nothing() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ph-dose-time-s", "2");
+    rig_run(dosa, 1000);
+
+    // the counters do see the host's own records allocate, a reconnect burst recorded
+    counting = true;
+    rig_device.new_mqtt_connection = true;
+    rig_run(dosa, 100);
+    rig_device.new_mqtt_connection = false;
+    CHECK(allocations > 0);
+    allocations = 0;
+
+    host_set_recording(false);
+
+    rig_device.new_mqtt_connection = true;
+    run_watching(dosa, RIG_TICK_MS);
+    rig_device.new_mqtt_connection = false;
+    rig_control(dosa, "ec-dose", "true");
+    rig_control(dosa, "ph-dose", "true");
+    rig_control(dosa, "run-mixture", "true");
+    run_watching(dosa, 10000);
+    rig_control(dosa, "batch", "ratio-of-A-to-B-%=40;ec-dose=true");
+    run_watching(dosa, 2000);
+    rig_control(dosa, "dose-lockout", "true");
+    run_watching(dosa, 1000);
+    rig_control(dosa, "dose-lockout", "false");
+    run_watching(dosa, 1000);
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+    run_watching(dosa, 1000);
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "dose-lockout", "false");
+    // past an idle report and the event log flush
+    run_watching(dosa, IDLE_REPORT_MS);
+
+    counting = false;
+    host_set_recording(true);
+    printf("%lu allocations over the dosing cycle\n", allocations);
+    CHECK(A_opened && ph_opened);
+    CHECK(allocations == 0);
+    delete dosa;
+}
+
+int main() {
+    dosing_cycle_allocates_nothing();
+    return check_result();
+}
@@ -0,0 +1,93 @@
+/*
+    Closed loop EC / pH dosing against the tank model: from the README start water to the README setpoints
+    without dosing past them, holding there against plant uptake, and nothing dosed while locked out.
+*/
+
+#include <math.h>
+
+#include <check.h>
+#include <rig.h>
+#include <tank.h>
+
+static Dosa_Cls *closed_loop_doser() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->ec_rise_per_ml = 0.0004;
+    dosa->ph_drop_per_ml = 0.0008;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ec-setpoint", "1.5");
+    rig_control(dosa, "ph-setpoint", "6.2");
+    rig_control(dosa, "closed-loop", "true");
+    return dosa;
+}
+
+static void reaches_setpoints() {
+    Dosa_Cls *dosa = closed_loop_doser();
+    Tank_Model_Cls tank;
+
+    double ec_peak = 0;
+    double ph_low = 14;
+    unsigned long ec_settled_ms = 0;
+    for (unsigned long minute = 0; minute < 90; minute++) {
+        tank.run(dosa, 60000);
+        ec_peak = fmax(ec_peak, tank.ec);
+        ph_low = fmin(ph_low, tank.ph);
+        if (fabs(tank.ec - 1.5) > 0.05) {
+            ec_settled_ms = millis();
+        }
+    }
+    printf("EC %.3f (peak %.3f, within 0.05 after %lu s), pH %.3f (low %.3f)\n", tank.ec, ec_peak,
+           ec_settled_ms / 1000, tank.ph, ph_low);
+
+    // the README run took about 20 minutes by hand
+    CHECK(ec_settled_ms < 40UL * 60000);
+    CHECK_NEAR(tank.ec, 1.5, 0.05);
+    CHECK_NEAR(tank.ph, 6.2, 0.05);
+    CHECK(ec_peak < 1.6);
+    CHECK(ph_low > 6.1);
+    delete dosa;
+}
+
+static void holds_against_uptake() {
+    Dosa_Cls *dosa = closed_loop_doser();
+    Tank_Model_Cls tank;
+    tank.ec_uptake_per_h = 0.2;
+    tank.ph_rise_per_h = 0.2;
+    tank.ec_noise = 0.01;
+    tank.ph_noise = 0.01;
+
+    tank.run(dosa, 3600000);
+    double ec_low = 14;
+    double ec_high = 0;
+    for (unsigned long minute = 0; minute < 180; minute++) {
+        tank.run(dosa, 60000);
+        ec_low = fmin(ec_low, tank.ec);
+        ec_high = fmax(ec_high, tank.ec);
+    }
+    printf("with uptake EC held between %.3f and %.3f, pH %.3f\n", ec_low, ec_high, tank.ph);
+    CHECK(ec_low > 1.4);
+    CHECK(ec_high < 1.6);
+    CHECK_NEAR(tank.ph, 6.2, 0.1);
+    delete dosa;
+}
+
+static void lockout_stops_dosing() {
+    Dosa_Cls *dosa = closed_loop_doser();
+    Tank_Model_Cls tank;
+    rig_control(dosa, "dose-lockout", "true");
+    tank.run(dosa, 30 * 60000);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, 0, millis()) == 0);
+    CHECK(rig_high_ms(RIG_PH_PIN, 0, millis()) == 0);
+    CHECK_NEAR(tank.ec, 0.3, 0.001);
+    delete dosa;
+}
+
+int main() {
+    reaches_setpoints();
+    holds_against_uptake();
+    lockout_stops_dosing();
+    return check_result();
+}
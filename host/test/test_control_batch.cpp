@@ -0,0 +1,71 @@
+/*
+    control/batch: one bad pair rejects the whole batch and leaves every value as it was, a good batch is
+    applied in order before the next tick, so the dose it starts uses all of it and never half.
+*/
+
+#include <check.h>
+#include <rig.h>
+
+static Dosa_Cls *batch_doser() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_run(dosa, 100);
+    return dosa;
+}
+
+static void bad_pair_rejects_batch() {
+    const char *bad[] = {
+        "flow-rate-lpm=20;ratio-of-A-to-B-%=abc;ec-dose=true",
+        "flow-rate-lpm=20;no-such-topic=1;ec-dose=true",
+        "flow-rate-lpm=20;ec-dose",
+        "ec-dose=true;ph-dose=maybe",
+        "",
+        ";;\n",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        Dosa_Cls *dosa = batch_doser();
+        unsigned long start = millis();
+        CHECK(!rig_control(dosa, "batch", bad[i]));
+        rig_run(dosa, 10000);
+        // not even the pairs before the bad one, no dose started
+        CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 0);
+
+        // and the flow rate is still 10 l/min, 1 l is 6 s of valve time
+        start = millis();
+        rig_control(dosa, "ec-dose", "true");
+        rig_run(dosa, 10000);
+        CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 3000);
+        CHECK(rig_high_ms(RIG_NUTRIENT_B_PIN, start, millis()) == 3000);
+        delete dosa;
+    }
+}
+
+static void good_batch_in_order() {
+    Dosa_Cls *dosa = batch_doser();
+    unsigned long start = millis();
+    // the later flow rate wins, and the dose it asks for already has the new ratio and flow
+    CHECK(rig_control(dosa, "batch", "flow-rate-lpm=20;ratio-of-A-to-B-%=25\nflow-rate-lpm=12;ec-dose=true"));
+    rig_run(dosa, 10000);
+    // 1 l at 12 l/min is 5 s of valve time, 25 % of it A
+    unsigned long A_ms = rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis());
+    unsigned long B_ms = rig_high_ms(RIG_NUTRIENT_B_PIN, start, millis());
+    printf("batch dose: A %lu ms, B %lu ms\n", A_ms, B_ms);
+    CHECK(A_ms == 1250);
+    CHECK(B_ms == 3750);
+
+    // a later single topic still overrides what the batch set
+    start = millis();
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 10000);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 2500);
+    delete dosa;
+}
+
+int main() {
+    bad_pair_rejects_batch();
+    good_batch_in_order();
+    return check_result();
+}
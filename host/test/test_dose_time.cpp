@@ -0,0 +1,77 @@
+/*
+    The integer ms dose windows against the float formula they replaced, over the flow rates, ratios and
+    dose amounts the doser is set up with, and the valve open times they turn into.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+#include <rig.h>
+
+static double published(const char *topic) {
+    // a time that never changed from its power on 0 is never published
+    const char *value = host_last_publish(topic);
+    return value != NULL ? atof(value) : 0;
+}
+
+static void sweep(float dose_amount_l) {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->dose_amount_l = dose_amount_l;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+
+    double worst = 0;
+    for (float flow = 0.5; flow < 30; flow += 0.25) {
+        char flow_text[16];
+        snprintf(flow_text, sizeof(flow_text), "%.2f", flow);
+        for (float ratio = 0; ratio <= 100; ratio += 0.5) {
+            char ratio_text[16];
+            snprintf(ratio_text, sizeof(ratio_text), "%.1f", ratio);
+            rig_control(dosa, "flow-rate-lpm", flow_text);
+            rig_control(dosa, "ratio-of-A-to-B-%", ratio_text);
+            rig_run(dosa, 4 * RIG_TICK_MS);
+
+            // what the float version worked out, before it truncated to whole ms
+            double float_A = ratio / 100.0 * dose_amount_l / flow * 60000;
+            double float_B = (100 - ratio) / 100.0 * dose_amount_l / flow * 60000;
+            double dose_A = published("status/nutrient-A-dosing-time-s");
+            double dose_B = published("status/nutrient-B-dosing-time-s");
+
+            // rounded to the nearest ms, the two sharing one rounding so they always add up to the dose
+            CHECK_NEAR(dose_A, float_A, 1);
+            CHECK_NEAR(dose_B, float_B, 1);
+            CHECK_NEAR(dose_A + dose_B, dose_amount_l * 60000.0 / flow, 0.5);
+            worst = fmax(worst, fmax(fabs(dose_A - float_A), fabs(dose_B - float_B)));
+        }
+    }
+    printf("dose %.2f l: worst difference from float %.3f ms\n", dose_amount_l, worst);
+    delete dosa;
+}
+
+static void valve_times() {
+    // the windows reach the valves, to the tick
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "30");
+    rig_run(dosa, 100);
+    unsigned long start = millis();
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 10000);
+
+    CHECK_NEAR(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()), 1800, RIG_TICK_MS);
+    CHECK_NEAR(rig_high_ms(RIG_NUTRIENT_B_PIN, start, millis()), 4200, RIG_TICK_MS);
+    CHECK(host_pin(RIG_NUTRIENT_A_PIN) == LOW);
+    CHECK(host_pin(RIG_NUTRIENT_B_PIN) == LOW);
+    delete dosa;
+}
+
+int main() {
+    sweep(0.25);
+    sweep(1);
+    sweep(2.5);
+    valve_times();
+    return check_result();
+}
@@ -0,0 +1,188 @@
+/*
+    The emergency stop interrupt: a press that lands part way through a tick, after the latch check but
+    before the dose channels run, still keeps a starting dose's valves shut, timed or volumetric, and they
+    stay shut until the lockout is released. The broker cannot release it while the button is held, and a
+    press shuts the valves in the interrupt however long the tick it lands in takes.
+*/
+
+#include <stdlib.h>
+
+#include <check.h>
+#include <rig.h>
+
+static bool press_armed = false;
+
+// the button goes down just after the poll has read it released
+static void press_after_poll(uint8_t pin) {
+    if (!press_armed || pin != RIG_EMERGENCY_STOP_PIN) {
+        return;
+    }
+    press_armed = false;
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+}
+
+static bool valve_opened_since(uint8_t pin, unsigned long from_ms) {
+    for (size_t i = 0; i < host_pin_writes.size(); i++) {
+        if (host_pin_writes[i].ms >= from_ms && host_pin_writes[i].pin == pin && host_pin_writes[i].state) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void press_mid_tick(bool volumetric) {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    if (volumetric) {
+        dosa->nutrient_A_flow_sensor_pin = RIG_NUTRIENT_A_FLOW_PIN;
+        dosa->nutrient_B_flow_sensor_pin = RIG_NUTRIENT_B_FLOW_PIN;
+        dosa->flow_sensor_pulses_per_ml = 10;
+    }
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_run(dosa, 100);
+
+    // the request moves A to dose_start, and the valve is staged open on the tick the press lands in
+    unsigned long pressed = millis();
+    rig_control(dosa, "ec-dose", "true");
+    host_advance_ms(RIG_TICK_MS);
+    dosa->main();
+    CHECK(!host_pin(RIG_NUTRIENT_A_PIN));
+    host_set_read_hook(press_after_poll);
+    press_armed = true;
+    host_advance_ms(RIG_TICK_MS);
+    dosa->main();
+    CHECK(!press_armed);
+    CHECK(!host_pin(RIG_NUTRIENT_A_PIN) && !host_pin(RIG_NUTRIENT_B_PIN));
+
+    // locked out from the next tick, and asking again does not open anything
+    rig_run(dosa, 1000);
+    const char *estop = host_last_publish("status/emergency-stop-button");
+    CHECK(estop != NULL && strcmp(estop, "true") == 0);
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 1000);
+    CHECK(!valve_opened_since(RIG_NUTRIENT_A_PIN, pressed));
+    CHECK(!valve_opened_since(RIG_NUTRIENT_B_PIN, pressed));
+
+    // released button and lockout, dosing is back
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "dose-lockout", "false");
+    rig_run(dosa, 100);
+    unsigned long released = millis();
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 100);
+    CHECK(valve_opened_since(RIG_NUTRIENT_A_PIN, released));
+    delete dosa;
+}
+
+static void held_button_keeps_lockout() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ph-dose-time-s", "5");
+    rig_run(dosa, 100);
+
+    unsigned long pressed = millis();
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+    rig_run(dosa, 100);
+    unsigned long lockouts = host_publish_count("status/doser-lockout");
+
+    // neither a release nor a lockout of its own from the broker touches the e-stop lockout
+    CHECK(!rig_control(dosa, "dose-lockout", "false"));
+    CHECK(rig_control(dosa, "dose-lockout", "true"));
+    rig_control(dosa, "batch", "dose-lockout=false;ec-dose=true;ph-dose=true");
+    rig_control(dosa, "ec-dose", "true");
+    rig_control(dosa, "ph-dose", "true");
+    rig_run(dosa, 2000);
+    CHECK(!valve_opened_since(RIG_NUTRIENT_A_PIN, pressed));
+    CHECK(!valve_opened_since(RIG_NUTRIENT_B_PIN, pressed));
+    CHECK(!valve_opened_since(RIG_PH_PIN, pressed));
+    CHECK(host_publish_count("status/doser-lockout") == lockouts);
+    CHECK(host_pin(RIG_LOCKOUT_LED_PIN) == HIGH);
+
+    // let go of the button and the same release goes through
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    CHECK(rig_control(dosa, "dose-lockout", "false"));
+    rig_run(dosa, 100);
+    unsigned long released = millis();
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 100);
+    CHECK(valve_opened_since(RIG_NUTRIENT_A_PIN, released));
+    delete dosa;
+}
+
+#define SLOW_PUBLISH_MS 250
+#define PRESSES 8
+
+static unsigned press_at_publish = 0;
+static bool shut_at_press = false;
+
+// a link that takes SLOW_PUBLISH_MS a publish, the button goes down during the press_at_publish'th one
+static void slow_publish(const char *) {
+    host_advance_ms(SLOW_PUBLISH_MS);
+    if (press_at_publish > 0 && --press_at_publish == 0) {
+        host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+        shut_at_press = !host_pin(RIG_NUTRIENT_A_PIN) && !host_pin(RIG_NUTRIENT_B_PIN);
+    }
+}
+
+static void saturated_loop_latency() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+
+    unsigned long longest_tick_ms = 0;
+    for (unsigned press = 0; press < PRESSES; press++) {
+        host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+        rig_control(dosa, "dose-lockout", "false");
+        rig_control(dosa, "ec-dose", "true");
+        rig_run(dosa, 100);
+        CHECK(host_pin(RIG_NUTRIENT_A_PIN) || host_pin(RIG_NUTRIENT_B_PIN));
+
+        // a reconnect's whole status burst at SLOW_PUBLISH_MS each, the press lands in a different publish
+        // every time
+        rig_device.new_mqtt_connection = true;
+        press_at_publish = press + 1;
+        shut_at_press = false;
+        host_set_publish_hook(slow_publish);
+        while (press_at_publish > 0) {
+            unsigned long start = millis();
+            dosa->main();
+            rig_device.new_mqtt_connection = false;
+            if (millis() - start > longest_tick_ms) {
+                longest_tick_ms = millis() - start;
+            }
+            host_advance_ms(RIG_TICK_MS);
+        }
+        host_set_publish_hook(NULL);
+        CHECK(shut_at_press);
+        rig_run(dosa, 20000);
+    }
+
+    // every press in the first bucket, under 4 us from the interrupt to the last valve pin, with ticks
+    // hundreds of ms long
+    const char *hist = host_last_publish("status/emergency-stop-latency-us");
+    CHECK(hist != NULL);
+    char *pos = (char *)hist;
+    unsigned long first = strtoul(pos, &pos, 10);
+    unsigned long rest = 0;
+    while (*pos == ',') {
+        rest += strtoul(pos + 1, &pos, 10);
+    }
+    printf("longest tick %lu ms, ISR to valves off histogram %s\n", longest_tick_ms, hist);
+    CHECK(first == PRESSES && rest == 0);
+    CHECK(longest_tick_ms >= 2 * SLOW_PUBLISH_MS);
+    delete dosa;
+}
+
+int main() {
+    press_mid_tick(false);
+    press_mid_tick(true);
+    held_button_keeps_lockout();
+    saturated_loop_latency();
+    return check_result();
+}
@@ -0,0 +1,113 @@
+/*
+    The dose event log across a broker outage: a log that fills while the broker is away keeps the newest
+    EVENT_LOG_SIZE records, and on reconnect the batches decode with the sequence number jumping over what
+    was dropped and running on without a gap after that.
+*/
+
+#include <vector>
+
+#include <check.h>
+#include <decode.h>
+#include <rig.h>
+
+#define DOSES 5
+
+// every status/events batch published from index from on, in order, false if any failed to decode
+static bool batches_since(size_t from, std::vector<Event_Batch> &batches) {
+    batches.clear();
+    for (size_t i = from; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic == "status/events") {
+            Event_Batch batch;
+            if (!decode_event_batch(host_publishes[i].value.c_str(), batch)) {
+                return false;
+            }
+            batches.push_back(batch);
+        }
+    }
+    return true;
+}
+
+// an EC dose, A and B each opening and closing
+static void ec_dose(Dosa_Cls *dosa) {
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 10000);
+}
+
+static void fills_while_disconnected() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+
+    // one dose while connected, flushed before the broker goes away
+    size_t start = host_publishes.size();
+    ec_dose(dosa);
+    rig_run(dosa, EVENT_FLUSH_MS);
+    std::vector<Event_Batch> batches;
+    CHECK(batches_since(start, batches));
+    uint32_t next_sequence = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+        CHECK(batches[i].sequence == next_sequence);
+        next_sequence += batches[i].count;
+    }
+    CHECK(next_sequence == 4);
+
+    // four events a dose, more than the ring holds
+    rig_device.mqtt_connected = false;
+    size_t disconnected = host_publishes.size();
+    for (uint8_t i = 0; i < DOSES; i++) {
+        ec_dose(dosa);
+    }
+    CHECK(host_publish_count("status/events") == batches.size());
+
+    rig_device.mqtt_connected = true;
+    rig_run(dosa, EVENT_FLUSH_MS);
+    CHECK(batches_since(disconnected, batches));
+    CHECK(!batches.empty());
+    if (batches.empty()) {
+        delete dosa;
+        return;
+    }
+
+    // the oldest records were dropped, the first batch starts after them
+    uint32_t logged = DOSES * 4;
+    uint32_t dropped = logged - EVENT_LOG_SIZE;
+    printf("%u events while away, %u dropped, first batch from sequence %u\n", (unsigned)logged,
+           (unsigned)dropped, (unsigned)batches[0].sequence);
+    CHECK(batches[0].sequence == next_sequence + dropped);
+    uint32_t received = 0;
+    uint32_t sequence = batches[0].sequence;
+    bool contiguous = true;
+    bool doses_whole = true;
+    for (size_t i = 0; i < batches.size(); i++) {
+        contiguous &= batches[i].sequence == sequence;
+        sequence += batches[i].count;
+        received += batches[i].count;
+        for (uint8_t j = 0; j < batches[i].count; j++) {
+            const Event_Record &record = batches[i].records[j];
+            doses_whole &= record.channel == dose_channel_A || record.channel == dose_channel_B;
+            if (record.type == event_valve_close) {
+                // half of 1 l at 10 l/min each
+                doses_whole &= record.duration_ms == 3000;
+            } else {
+                doses_whole &= record.type == event_valve_open;
+            }
+        }
+    }
+    CHECK(contiguous);
+    CHECK(received == EVENT_LOG_SIZE);
+    CHECK(doses_whole);
+
+    // and on from there, no gap once the broker is back
+    size_t reconnected = host_publishes.size();
+    ec_dose(dosa);
+    rig_run(dosa, EVENT_FLUSH_MS);
+    CHECK(batches_since(reconnected, batches));
+    CHECK(!batches.empty() && batches[0].sequence == sequence);
+    delete dosa;
+}
+
+int main() {
+    fills_while_disconnected();
+    return check_result();
+}
@@ -0,0 +1,112 @@
+/*
+    The sweep's job pool: every job runs exactly once, idle workers steal from one held up by long jobs, and
+    each worker thread is a board of its own, so a dose run on four threads at once comes out the same as
+    on one.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <check.h>
+#include <job_pool.h>
+#include <rig.h>
+
+#define JOBS 400
+#define DOSE_JOBS 16
+
+static std::atomic<int> runs[JOBS];
+
+static void count_job(size_t index, unsigned, void *) {
+    runs[index]++;
+}
+
+static void each_job_once() {
+    for (size_t i = 0; i < JOBS; i++) {
+        runs[i] = 0;
+    }
+    Job_Pool_Cls pool(4);
+    pool.run(JOBS, count_job, NULL);
+    bool once = true;
+    for (size_t i = 0; i < JOBS; i++) {
+        once &= runs[i] == 1;
+    }
+    CHECK(once);
+
+    // and again on the same pool, a pool is reused for every sweep
+    pool.run(JOBS, count_job, NULL);
+    CHECK(runs[0] == 2 && runs[JOBS - 1] == 2);
+}
+
+// worker 0's run is all long jobs
+static void slow_first_run(size_t index, unsigned, void *) {
+    if (index < JOBS / 4) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    runs[index]++;
+}
+
+static void steals_from_slow_worker() {
+    for (size_t i = 0; i < JOBS; i++) {
+        runs[i] = 0;
+    }
+    Job_Pool_Cls pool(4);
+    pool.run(JOBS, slow_first_run, NULL);
+    CHECK(pool.steals() > 0);
+    bool once = true;
+    for (size_t i = 0; i < JOBS; i++) {
+        once &= runs[i] == 1;
+    }
+    CHECK(once);
+}
+
+struct Dose_Run {
+    unsigned long high_A_ms;
+    unsigned long high_B_ms;
+    size_t pin_writes;
+    size_t publishes;
+};
+
+static Dose_Run dose_runs[DOSE_JOBS];
+
+// an EC dose whose size depends on the job, so jobs that shared a board would not add up
+static void dose_job(size_t index, unsigned, void *) {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    char ratio[8];
+    snprintf(ratio, sizeof(ratio), "%u", (unsigned)(20 + index * 4));
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", ratio);
+    rig_run(dosa, 100);
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 20000);
+    Dose_Run run = {rig_high_ms(RIG_NUTRIENT_A_PIN, 0, millis()), rig_high_ms(RIG_NUTRIENT_B_PIN, 0, millis()),
+                    host_pin_writes.size(), host_publishes.size()};
+    dose_runs[index] = run;
+    delete dosa;
+}
+
+static void board_per_thread() {
+    Job_Pool_Cls one(1);
+    one.run(DOSE_JOBS, dose_job, NULL);
+    Dose_Run alone[DOSE_JOBS];
+    memcpy(alone, dose_runs, sizeof(alone));
+    CHECK(alone[0].high_A_ms == 1200 && alone[0].high_B_ms == 4800);
+
+    memset(dose_runs, 0, sizeof(dose_runs));
+    Job_Pool_Cls four(4);
+    four.run(DOSE_JOBS, dose_job, NULL);
+    bool same = true;
+    for (size_t i = 0; i < DOSE_JOBS; i++) {
+        same &= dose_runs[i].high_A_ms == alone[i].high_A_ms && dose_runs[i].high_B_ms == alone[i].high_B_ms &&
+                dose_runs[i].pin_writes == alone[i].pin_writes && dose_runs[i].publishes == alone[i].publishes;
+    }
+    CHECK(same);
+}
+
+int main() {
+    each_job_once();
+    steals_from_slow_worker();
+    board_per_thread();
+    return check_result();
+}
@@ -0,0 +1,205 @@
+/*
+    The Modbus RTU master against a simulated RS485 line: round robin polling, timeouts, CRC and exception
+    replies, and replies whose byte count could not fit the frame buffer.
+*/
+
+#include <deque>
+
+#include <check.h>
+#include <host.h>
+#include <modbus_master.h>
+
+enum slave_reply {
+    reply_value,
+    reply_silent,
+    reply_bad_crc,
+    reply_exception,
+    reply_oversized,            // 01 03 FB and then as much line noise as the master will take
+};
+
+// the sensors on the line, addressed 1 up, each answering the way its entry says 5 ms after a request
+class Slave_Line : public Stream {
+
+  public:
+
+    slave_reply replies[MODBUS_MAX_SENSORS + 1];
+    int16_t values[MODBUS_MAX_SENSORS + 1];
+
+    Slave_Line() : length(0), due_us(0), pending(false) {
+        for (uint8_t i = 0; i <= MODBUS_MAX_SENSORS; i++) {
+            this->replies[i] = reply_value;
+            this->values[i] = 0;
+        }
+    }
+
+    int available() {
+        if (this->pending && micros() >= this->due_us) {
+            this->pending = false;
+            this->answer();
+        }
+        return this->rx.size();
+    }
+
+    int read() {
+        if (this->rx.empty()) {
+            return -1;
+        }
+        int value = this->rx.front();
+        this->rx.pop_front();
+        return value;
+    }
+
+    size_t write(uint8_t value) {
+        this->request[this->length++] = value;
+        if (this->length == sizeof(this->request)) {
+            this->length = 0;
+            this->pending = true;
+            this->due_us = micros() + 5000;
+        }
+        return 1;
+    }
+
+  private:
+
+    std::deque<uint8_t> rx;
+    uint8_t request[8];
+    uint8_t length;
+    unsigned long due_us;
+    bool pending;
+
+    void send(uint8_t *frame, uint8_t length) {
+        uint16_t crc = Modbus_Master_Cls::crc16(frame, length);
+        frame[length] = crc & 0xFF;
+        frame[length + 1] = crc >> 8;
+        for (uint8_t i = 0; i < length + 2; i++) {
+            this->rx.push_back(frame[i]);
+        }
+    }
+
+    void answer() {
+        uint8_t address = this->request[0];
+        uint8_t frame[MODBUS_MAX_FRAME + 8];
+        frame[0] = address;
+        frame[1] = this->request[1];
+        switch (address <= MODBUS_MAX_SENSORS ? this->replies[address] : reply_silent) {
+            case reply_value:
+                frame[2] = 2;
+                frame[3] = (uint16_t)this->values[address] >> 8;
+                frame[4] = this->values[address] & 0xFF;
+                this->send(frame, 5);
+                break;
+            case reply_silent:
+                break;
+            case reply_bad_crc:
+                frame[2] = 2;
+                frame[3] = 0;
+                frame[4] = 1;
+                this->send(frame, 5);
+                this->rx.back() ^= 0x55;
+                break;
+            case reply_exception:
+                frame[1] |= 0x80;
+                frame[2] = 2;
+                this->send(frame, 3);
+                break;
+            case reply_oversized:
+                frame[2] = 0xFB;
+                for (uint8_t i = 3; i < sizeof(frame) - 2; i++) {
+                    frame[i] = i;
+                }
+                this->send(frame, sizeof(frame) - 2);
+                break;
+        }
+    }
+};
+
+static void run_bus(Modbus_Master_Cls &modbus, unsigned long ms) {
+    for (unsigned long us = 0; us < ms * 1000; us += 100) {
+        host_advance_us(100);
+        modbus.main();
+    }
+}
+
+static void polls_every_sensor() {
+    host_reset();
+    Slave_Line line;
+    line.values[1] = 152;
+    line.values[2] = 621;
+    line.values[3] = -40;
+    Modbus_Master_Cls modbus;
+    modbus.serial = &line;
+    modbus.baud = 19200;
+    modbus.init();
+    int8_t ec = modbus.add_sensor(1, MODBUS_READ_HOLDING, 0, 0.01, 1000);
+    int8_t ph = modbus.add_sensor(2, MODBUS_READ_HOLDING, 0, 0.01, 1000);
+    int8_t temperature = modbus.add_sensor(3, MODBUS_READ_INPUT, 4, 0.1, 1000);
+
+    run_bus(modbus, 10000);
+    float value;
+    CHECK(modbus.read_sensor(ec, &value));
+    CHECK_NEAR(value, 1.52, 1e-5);
+    CHECK(!modbus.read_sensor(ec, &value));
+    CHECK(modbus.read_sensor(ph, &value));
+    CHECK_NEAR(value, 6.21, 1e-5);
+    CHECK(modbus.read_sensor(temperature, &value));
+    CHECK_NEAR(value, -4.0, 1e-5);
+    // each sensor once a second, none starved
+    CHECK_NEAR(modbus.polls, 30, 3);
+    CHECK(modbus.timeouts == 0);
+    CHECK(modbus.errors == 0);
+}
+
+static void counts_bad_replies() {
+    host_reset();
+    Slave_Line line;
+    line.replies[2] = reply_silent;
+    line.replies[3] = reply_bad_crc;
+    line.replies[4] = reply_exception;
+    line.values[1] = 100;
+    Modbus_Master_Cls modbus;
+    modbus.serial = &line;
+    modbus.baud = 9600;
+    modbus.init();
+    int8_t good = modbus.add_sensor(1, MODBUS_READ_HOLDING, 0, 1, 1000);
+    modbus.add_sensor(2, MODBUS_READ_HOLDING, 0, 1, 1000);
+    int8_t bad_crc = modbus.add_sensor(3, MODBUS_READ_HOLDING, 0, 1, 1000);
+    modbus.add_sensor(4, MODBUS_READ_HOLDING, 0, 1, 1000);
+
+    run_bus(modbus, 10050);
+    float value;
+    CHECK(modbus.timeouts == 10);
+    CHECK(modbus.errors == 20);
+    CHECK(!modbus.read_sensor(bad_crc, &value));
+    // a silent neighbour does not hold up the sensor after it
+    CHECK(modbus.read_sensor(good, &value));
+    CHECK(value == 100);
+}
+
+static void rejects_oversized_byte_count() {
+    host_reset();
+    Slave_Line line;
+    line.replies[1] = reply_oversized;
+    line.values[2] = 7;
+    Modbus_Master_Cls modbus;
+    modbus.serial = &line;
+    modbus.baud = 19200;
+    modbus.init();
+    int8_t noisy = modbus.add_sensor(1, MODBUS_READ_HOLDING, 0, 1, 1000);
+    int8_t next = modbus.add_sensor(2, MODBUS_READ_HOLDING, 0, 1, 1000);
+
+    run_bus(modbus, 5000);
+    float value;
+    // an error as soon as the byte count is in, not a timeout, and the bus carries on
+    CHECK(modbus.errors == 5);
+    CHECK(modbus.timeouts == 0);
+    CHECK(!modbus.read_sensor(noisy, &value));
+    CHECK(modbus.read_sensor(next, &value));
+    CHECK(value == 7);
+}
+
+int main() {
+    polls_every_sensor();
+    counts_bad_replies();
+    rejects_oversized_byte_count();
+    return check_result();
+}
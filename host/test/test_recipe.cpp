@@ -0,0 +1,137 @@
+/*
+    The on-device recipe: the last step carries on past midnight into the first, a doser that boots before
+    the first step runs yesterday's last, and the recipe goes into EEPROM a byte a tick, without losing a
+    snapshot that was being written when it arrived, before it runs.
+*/
+
+#include <stdlib.h>
+
+#include <EEPROM.h>
+
+#include <check.h>
+#include <rig.h>
+
+#define RECIPE_BASE 16
+#define DAY_RECIPE "06:00,1.2,6.0,50,2;22:00,1.6,6.2,40,3"
+
+static Dosa_Cls *recipe_doser() {
+    Dosa_Cls *dosa = rig_doser();
+    dosa->eeprom_address = RECIPE_BASE;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    return dosa;
+}
+
+static int published_step() {
+    const char *step = host_last_publish("status/recipe-step");
+    return step != NULL ? atoi(step) : -2;
+}
+
+static int published_ph_dose_time() {
+    const char *time = host_last_publish("control/ph-dose-time-s");
+    return time != NULL ? atoi(time) : -1;
+}
+
+// run until the recipe has gone into EEPROM, the most bytes any tick wrote
+static unsigned long write_out(Dosa_Cls *dosa) {
+    unsigned long most = 0;
+    for (unsigned long tick = 0; tick < 2000; tick++) {
+        unsigned long before = EEPROM.bytes_written;
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+        if (EEPROM.bytes_written - before > most) {
+            most = EEPROM.bytes_written - before;
+        }
+    }
+    return most;
+}
+
+static void past_midnight() {
+    rig_reset();
+    Dosa_Cls *dosa = recipe_doser();
+    rig_control(dosa, "time-of-day", "23:50");
+    CHECK(rig_control(dosa, "recipe", DAY_RECIPE));
+    // runs once it is whole in EEPROM, not while it is being written
+    rig_run(dosa, 200);
+    CHECK(published_step() == -1);
+    write_out(dosa);
+    CHECK(published_step() == 1);
+    CHECK(published_ph_dose_time() == 3);
+
+    // over midnight on the doser's own clock, the 22:00 step keeps running
+    unsigned long steps = host_publish_count("status/recipe-step");
+    rig_run(dosa, 30UL * 60000);
+    CHECK(host_publish_count("status/recipe-step") == steps);
+    CHECK(published_step() == 1);
+
+    // and hands over to the first step at 06:00
+    rig_control(dosa, "time-of-day", "05:59");
+    rig_run(dosa, 2UL * 60000);
+    CHECK(published_step() == 0);
+    CHECK(published_ph_dose_time() == 2);
+    delete dosa;
+}
+
+static void boots_before_first_step() {
+    rig_reset();
+    Dosa_Cls *dosa = recipe_doser();
+    rig_control(dosa, "recipe", DAY_RECIPE);
+    write_out(dosa);
+    delete dosa;
+
+    // restored from EEPROM, and at 03:00 it is still yesterday's 22:00 step
+    rig_restart();
+    dosa = recipe_doser();
+    rig_control(dosa, "time-of-day", "03:00");
+    rig_run(dosa, 1000);
+    CHECK(published_step() == 1);
+    CHECK(published_ph_dose_time() == 3);
+    delete dosa;
+}
+
+static void written_a_byte_a_tick() {
+    rig_reset();
+    Dosa_Cls *dosa = recipe_doser();
+    rig_run(dosa, SNAPSHOT_WRITE_MS);
+
+    // a snapshot is part way into EEPROM when the recipe arrives
+    rig_control(dosa, "flow-rate-lpm", "12");
+    unsigned long written = EEPROM.bytes_written;
+    unsigned long end = millis() + 2 * SNAPSHOT_WRITE_MS;
+    while (EEPROM.bytes_written < written + 3 && millis() < end) {
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+    }
+    written = EEPROM.bytes_written;
+    CHECK(rig_control(dosa, "recipe", DAY_RECIPE));
+    CHECK(EEPROM.bytes_written == written);
+    CHECK(write_out(dosa) == 1);
+    rig_run(dosa, SNAPSHOT_WRITE_MS + 2 * SNAPSHOT_CHECK_MS);
+
+    // the broker replaying the same retained recipe writes nothing
+    written = EEPROM.bytes_written;
+    rig_control(dosa, "recipe", DAY_RECIPE);
+    rig_run(dosa, 1000);
+    CHECK(EEPROM.bytes_written == written);
+    delete dosa;
+
+    // both the recipe and the snapshot it cut into came back
+    rig_restart();
+    dosa = recipe_doser();
+    rig_device.new_control_connection = true;
+    rig_run(dosa, RIG_TICK_MS);
+    rig_device.new_control_connection = false;
+    rig_control(dosa, "time-of-day", "12:00");
+    rig_run(dosa, 1000);
+    CHECK(published_step() == 0);
+    const char *flow = host_last_publish("control/flow-rate-lpm");
+    CHECK(flow != NULL && strcmp(flow, "12.00") == 0);
+    delete dosa;
+}
+
+int main() {
+    past_midnight();
+    boots_before_first_step();
+    written_a_byte_a_tick();
+    return check_result();
+}
@@ -0,0 +1,89 @@
+/*
+    millis() rolling over at 2^32, built with a 32 bit long as on AVR (stubs/long32.h). A dose that starts
+    just before the wrap and a recipe step that runs across it keep their times: the valves stay open for
+    the dose time and no longer, the safety timer does not trip, and the next step starts on the minute.
+*/
+
+#include <stdlib.h>
+
+#include <check.h>
+#include <rig.h>
+
+#define ROLLOVER_EEPROM_BASE 16
+#define ROLLOVER_RECIPE "06:00,1.2,6.0,50,2;06:07,1.6,6.2,40,3"
+
+// unsigned long arithmetic, so it wraps at 2^32 here
+static unsigned long ms_to_wrap() {
+    return (unsigned long)0 - millis();
+}
+
+static int published_step() {
+    const char *step = host_last_publish("status/recipe-step");
+    return step != NULL ? atoi(step) : -2;
+}
+
+// ms the last opening of a pin lasted, 0 if it never closed
+static unsigned long last_opening_ms(uint8_t pin, unsigned long &opened) {
+    unsigned long duration = 0;
+    bool high = false;
+    for (size_t i = 0; i < host_pin_writes.size(); i++) {
+        const Host_Pin_Write &write = host_pin_writes[i];
+        if (write.pin != pin || write.state == high) {
+            continue;
+        }
+        if (write.state) {
+            opened = write.ms;
+        } else {
+            duration = write.ms - opened;
+        }
+        high = write.state;
+    }
+    return high ? 0 : duration;
+}
+
+static void dose_and_step_across_wrap() {
+    CHECK(sizeof(unsigned long) == 4);
+
+    // five minutes before the wrap, at 06:00 on the doser's clock
+    rig_reset();
+    host_set_millis((unsigned long)0 - 300000);
+    Dosa_Cls *dosa = rig_doser();
+    dosa->eeprom_address = ROLLOVER_EEPROM_BASE;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "time-of-day", "06:00");
+    CHECK(rig_control(dosa, "recipe", ROLLOVER_RECIPE));
+    rig_run(dosa, 20000);
+    CHECK(published_step() == 0);
+
+    // a dose from 1.5 s before the wrap, 1 l at 10 l/min and 50 % A is 3 s a valve
+    rig_run(dosa, ms_to_wrap() - 1500);
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 10000);
+    unsigned long A_opened = 0;
+    unsigned long B_opened = 0;
+    unsigned long A_ms = last_opening_ms(RIG_NUTRIENT_A_PIN, A_opened);
+    unsigned long B_ms = last_opening_ms(RIG_NUTRIENT_B_PIN, B_opened);
+    printf("A open %u ms from %u, B open %u ms from %u, now %u\n", (unsigned)A_ms, (unsigned)A_opened,
+           (unsigned)B_ms, (unsigned)B_opened, (unsigned)millis());
+    // opened before the wrap, closed after it
+    CHECK(A_opened > millis());
+    CHECK(A_ms == 3000 && B_ms == 3000);
+    const char *lockout = host_last_publish("status/doser-safety-timer-lockout-ec");
+    CHECK(lockout == NULL || strcmp(lockout, "false") == 0);
+
+    // 06:05:08 now, the second step starts at 06:07 on a clock set before the wrap
+    rig_run(dosa, 100000);
+    CHECK(published_step() == 0);
+    rig_run(dosa, 40000);
+    CHECK(published_step() == 1);
+    const char *ph_dose_time = host_last_publish("control/ph-dose-time-s");
+    CHECK(ph_dose_time != NULL && strcmp(ph_dose_time, "3") == 0);
+    delete dosa;
+}
+
+int main() {
+    dose_and_step_across_wrap();
+    return check_result();
+}
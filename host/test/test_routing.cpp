@@ -0,0 +1,96 @@
+/*
+    Eight heads on one controller: a control topic reaches only the head its instance number names, stray
+    or out of range instance numbers reach none, the single dispatch entry delivers each message once, and
+    control/time-of-day to one head sets the clock every
+    head's recipe runs on.
+*/
+
+#include <check.h>
+#include <rig.h>
+#include <utils.h>
+
+#define HEADS 8
+#define ROUTING_EEPROM_BASE 16
+
+static void topic_for(Dosa_Cls *dosa, const char *name, char *topic) {
+    dosa->get_commission_path_str(topic);
+    strcat(topic, "control/");
+    strcat(topic, name);
+}
+
+static void routes_by_instance(Dosa_Cls **dosas) {
+    char topic[MAX_PATH_LENGTH];
+    for (uint8_t i = 0; i < HEADS; i++) {
+        topic_for(dosas[i], "flow-rate-lpm", topic);
+        CHECK(Dosa_Cls::route(topic) == dosas[i]);
+        // every head is offered the message, as the bridge does, only the one it is for takes it
+        char payload[8];
+        uint8_t taken = 0;
+        for (uint8_t j = 0; j < HEADS; j++) {
+            snprintf(payload, sizeof(payload), "%u", 10 + i);
+            taken += dosas[j]->process_message(topic, payload);
+        }
+        CHECK(taken == 1);
+
+        // through the bridge's single entry point, one call and the head has the value, a reconnect on
+        // that head alone publishes it
+        snprintf(payload, sizeof(payload), "%u", 20 + i);
+        CHECK(Dosa_Cls::dispatch(topic, payload));
+        rig_device.new_mqtt_connection = true;
+        rig_run(dosas[i], RIG_TICK_MS);
+        rig_device.new_mqtt_connection = false;
+        rig_run(dosas[i], 100);
+        const char *flow = host_last_publish("control/flow-rate-lpm");
+        CHECK(flow != NULL && strtol(flow, NULL, 10) == 20 + i);
+    }
+
+    // one rig device, so every head shares a mac, only the instance number tells them apart
+    char stray[MAX_PATH_LENGTH];
+    strcpy(stray, "000000000000/12/dosa/control/flow-rate-lpm");
+    CHECK(Dosa_Cls::route(stray) == NULL);
+    strcpy(stray, "000000000000/x3/dosa/control/flow-rate-lpm");
+    CHECK(Dosa_Cls::route(stray) == NULL);
+    strcpy(stray, "000000000000//dosa/control/flow-rate-lpm");
+    CHECK(Dosa_Cls::route(stray) == NULL);
+    strcpy(stray, "000000000000/3/other/control/flow-rate-lpm");
+    CHECK(Dosa_Cls::route(stray) == NULL);
+    strcpy(stray, "000000000000/03/dosa/control/flow-rate-lpm");
+    CHECK(Dosa_Cls::route(stray) == dosas[3]);
+    strcpy(stray, "000000000000/12/dosa/control/flow-rate-lpm");
+    char payload[] = "10";
+    CHECK(!Dosa_Cls::dispatch(stray, payload));
+}
+
+static void shared_clock(Dosa_Cls **dosas) {
+    // a one step recipe on the last head, the time only ever sent to the first
+    rig_control(dosas[HEADS - 1], "recipe", "00:00,1.4,6.1,45,4");
+    rig_control(dosas[0], "time-of-day", "08:00");
+    for (unsigned long tick = 0; tick < 2000; tick++) {
+        host_advance_ms(RIG_TICK_MS);
+        for (uint8_t i = 0; i < HEADS; i++) {
+            dosas[i]->main();
+        }
+    }
+    // every head publishes on its own path, so the last step publish can only have come from the last head
+    const char *step = host_last_publish("status/recipe-step");
+    CHECK(step != NULL && strcmp(step, "0") == 0);
+}
+
+int main() {
+    rig_reset();
+    Dosa_Cls *dosas[HEADS];
+    for (uint8_t i = 0; i < HEADS; i++) {
+        dosas[i] = rig_doser();
+        dosas[i]->eeprom_address = ROUTING_EEPROM_BASE;
+        dosas[i]->init();
+    }
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    CHECK(dosas[HEADS - 1]->instance_number == HEADS - 1);
+
+    routes_by_instance(dosas);
+    shared_clock(dosas);
+    for (uint8_t i = 0; i < HEADS; i++) {
+        delete dosas[i];
+    }
+    return check_result();
+}
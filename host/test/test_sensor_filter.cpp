@@ -0,0 +1,139 @@
+/*
+    The EC / pH reading filter on its own, the closed loop acting once the tank has settled rather than at
+    the closed_loop_interval_ms backstop, and outside dose requests held off until it has.
+*/
+
+#include <check.h>
+#include <rig.h>
+#include <sensor_filter.h>
+#include <tank.h>
+
+static void drops_single_spikes() {
+    Sensor_Filter_Cls filter;
+    unsigned long now = 0;
+    for (uint8_t i = 0; i < 20; i++) {
+        now += 10000;
+        filter.add(i == 12 ? 9.9 : 1.5, now);
+    }
+    CHECK_NEAR(filter.value, 1.5, 1e-6);
+    CHECK(filter.settled());
+}
+
+static void settles_after_a_step() {
+    Sensor_Filter_Cls filter;
+    unsigned long now = 0;
+    for (uint8_t i = 0; i < 10; i++) {
+        now += 10000;
+        filter.add(1.2, now);
+    }
+    CHECK(filter.settled());
+
+    // a dose restarts the filter, it can not be settled until min_samples new readings are in
+    filter.restart();
+    CHECK(!filter.settled());
+
+    // the reading climbs while the dose mixes in, then holds
+    uint8_t settled_at = 0;
+    for (uint8_t i = 0; i < 60; i++) {
+        now += 10000;
+        float reading = i < 20 ? 1.2 + 0.015 * i : 1.5;
+        filter.add(reading, now);
+        if (i < 20) {
+            CHECK(!filter.settled());
+        } else if (settled_at == 0 && filter.settled()) {
+            settled_at = i;
+        }
+    }
+    CHECK(settled_at > 20);
+    CHECK(settled_at < 40);
+    CHECK_NEAR(filter.value, 1.5, 0.005);
+}
+
+static void acts_before_backstop() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->ec_rise_per_ml = 0.0004;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    rig_control(dosa, "ec-setpoint", "1.5");
+    rig_control(dosa, "closed-loop", "true");
+
+    Tank_Model_Cls tank;
+    tank.mix_time_s = 45;
+    tank.run(dosa, 30 * 60000);
+
+    // the gaps between EC doses, each should end once the tank settled, well inside the 10 minute backstop
+    unsigned long last_open = 0;
+    uint8_t doses = 0;
+    for (size_t i = 0; i < host_pin_writes.size(); i++) {
+        const Host_Pin_Write &write = host_pin_writes[i];
+        if (write.pin != RIG_NUTRIENT_A_PIN || !write.state) {
+            continue;
+        }
+        if (doses > 0) {
+            printf("EC dose %u after %lu s\n", doses + 1, (write.ms - last_open) / 1000);
+            CHECK(write.ms - last_open < dosa->closed_loop_interval_ms);
+        }
+        last_open = write.ms;
+        doses++;
+    }
+    CHECK(doses >= 2);
+    const char *settled = host_last_publish("status/settled");
+    CHECK(settled != NULL && strcmp(settled, "true") == 0);
+    delete dosa;
+}
+
+// an EC reading every 10 s, the first count of them climbing by step from from
+static void feed_ec(Dosa_Cls *dosa, float from, float step, uint8_t count, uint8_t total) {
+    char payload[16];
+    for (uint8_t i = 0; i < total; i++) {
+        snprintf(payload, sizeof(payload), "%.3f", from + step * (i < count ? i : count));
+        rig_control(dosa, "ec-reading", payload);
+        rig_run(dosa, 10000);
+    }
+}
+
+static void outside_dose_waits_for_settle() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "50");
+    feed_ec(dosa, 1.2, 0, 0, 12);
+
+    unsigned long start = millis();
+    CHECK(rig_control(dosa, "ec-dose", "true"));
+    rig_run(dosa, 10000);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 3000);
+
+    // still climbing from that dose, a second request is refused and nothing opens
+    feed_ec(dosa, 1.2, 0.015, 10, 10);
+    start = millis();
+    CHECK(!rig_control(dosa, "ec-dose", "true"));
+    rig_run(dosa, 10000);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 0);
+
+    // once the readings hold it goes in, well before the backstop
+    feed_ec(dosa, 1.5, 0, 0, 20);
+    const char *settled = host_last_publish("status/settled");
+    CHECK(settled != NULL && strcmp(settled, "true") == 0);
+    start = millis();
+    CHECK(rig_control(dosa, "ec-dose", "true"));
+    rig_run(dosa, 10000);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == 3000);
+
+    // pH gets no readings, its doses are never held
+    CHECK(rig_control(dosa, "ph-dose", "true"));
+    rig_run(dosa, 10000);
+    CHECK(rig_control(dosa, "ph-dose", "true"));
+    delete dosa;
+}
+
+int main() {
+    drops_single_spikes();
+    settles_after_a_step();
+    acts_before_backstop();
+    outside_dose_waits_for_settle();
+    return check_result();
+}
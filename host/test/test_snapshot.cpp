@@ -0,0 +1,163 @@
+/*
+    The EEPROM control snapshot: values come back after a reset, a corrupt or half written newest slot
+    falls back to the one before it, another layout version is ignored, and a write never costs a tick
+    more than one EEPROM byte.
+*/
+
+#include <EEPROM.h>
+
+#include <check.h>
+#include <rig.h>
+
+#define SNAPSHOT_BASE 16
+
+static Dosa_Cls *snapshot_doser() {
+    Dosa_Cls *dosa = rig_doser();
+    dosa->eeprom_address = SNAPSHOT_BASE;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    return dosa;
+}
+
+static int slot_address(uint8_t slot) {
+    return SNAPSHOT_BASE + slot * sizeof(Dosa_Snapshot);
+}
+
+// the valid slot with the highest sequence, -1 if none
+static int newest_slot() {
+    int newest = -1;
+    uint16_t sequence = 0;
+    for (uint8_t slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        Dosa_Snapshot image;
+        EEPROM.get(slot_address(slot), image);
+        if (image.version != SNAPSHOT_VERSION ||
+            image.crc != Modbus_Master_Cls::crc16((uint8_t *)&image, offsetof(Dosa_Snapshot, crc))) {
+            continue;
+        }
+        if (newest < 0 || (int16_t)(image.sequence - sequence) > 0) {
+            newest = slot;
+            sequence = image.sequence;
+        }
+    }
+    return newest;
+}
+
+static void settle_flow(Dosa_Cls *dosa, const char *flow) {
+    rig_control(dosa, "flow-rate-lpm", flow);
+    rig_run(dosa, SNAPSHOT_WRITE_MS + 2 * SNAPSHOT_CHECK_MS);
+}
+
+// what a rebooted doser publishes for its flow rate once it is connected
+static const char *restored_flow() {
+    rig_restart();
+    Dosa_Cls *dosa = snapshot_doser();
+    // the bridge raises this for one loop after connecting
+    rig_device.new_control_connection = true;
+    rig_run(dosa, RIG_TICK_MS);
+    rig_device.new_control_connection = false;
+    rig_run(dosa, 500);
+    delete dosa;
+    return host_last_publish("control/flow-rate-lpm");
+}
+
+static void restores_after_reset() {
+    rig_reset();
+    Dosa_Cls *dosa = snapshot_doser();
+    rig_control(dosa, "ratio-of-A-to-B-%", "40");
+    rig_control(dosa, "ph-dose-time-s", "3");
+    settle_flow(dosa, "12");
+    delete dosa;
+
+    const char *flow = restored_flow();
+    CHECK(flow != NULL && strcmp(flow, "12.00") == 0);
+    const char *ratio = host_last_publish("control/ratio-of-A-to-B-%");
+    CHECK(ratio != NULL && strcmp(ratio, "40.00") == 0);
+    const char *ph_dose_time = host_last_publish("control/ph-dose-time-s");
+    CHECK(ph_dose_time != NULL && strcmp(ph_dose_time, "3") == 0);
+}
+
+static void corrupt_newest_slot() {
+    rig_reset();
+    Dosa_Cls *dosa = snapshot_doser();
+    settle_flow(dosa, "11");
+    settle_flow(dosa, "13");
+    delete dosa;
+
+    int newest = newest_slot();
+    CHECK(newest >= 0);
+    EEPROM.mem[slot_address(newest) + offsetof(Dosa_Snapshot, flow_rate_mlpm)] ^= 0x40;
+    const char *flow = restored_flow();
+    CHECK(flow != NULL && strcmp(flow, "11.00") == 0);
+}
+
+static void version_mismatch() {
+    rig_reset();
+    Dosa_Cls *dosa = snapshot_doser();
+    settle_flow(dosa, "14");
+    delete dosa;
+
+    // an older layout with a good CRC of its own is still not read
+    for (uint8_t slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        Dosa_Snapshot image;
+        EEPROM.get(slot_address(slot), image);
+        image.version = SNAPSHOT_VERSION - 1;
+        image.crc = Modbus_Master_Cls::crc16((uint8_t *)&image, offsetof(Dosa_Snapshot, crc));
+        EEPROM.put(slot_address(slot), image);
+    }
+    const char *flow = restored_flow();
+    CHECK(flow != NULL && strcmp(flow, "0.00") == 0);
+}
+
+static void spread_over_ticks() {
+    rig_reset();
+    Dosa_Cls *dosa = snapshot_doser();
+    rig_run(dosa, SNAPSHOT_WRITE_MS);
+    rig_control(dosa, "flow-rate-lpm", "9");
+    rig_control(dosa, "ec-setpoint", "1.2");
+
+    // never more than one byte a tick, and a lockout is in EEPROM within a couple of seconds of arriving
+    unsigned long most = 0;
+    for (unsigned long tick = 0; tick < 500; tick++) {
+        unsigned long before = EEPROM.bytes_written;
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+        if (EEPROM.bytes_written - before > most) {
+            most = EEPROM.bytes_written - before;
+        }
+    }
+    CHECK(most == 1);
+    rig_control(dosa, "dose-lockout", "true");
+    rig_run(dosa, 2 * SNAPSHOT_CHECK_MS);
+    Dosa_Snapshot image;
+    EEPROM.get(slot_address(newest_slot()), image);
+    CHECK(image.flags & 1);
+    delete dosa;
+}
+
+static void reset_mid_write() {
+    rig_reset();
+    Dosa_Cls *dosa = snapshot_doser();
+    settle_flow(dosa, "8");
+    rig_control(dosa, "flow-rate-lpm", "15");
+    // stop a few bytes into the next write
+    unsigned long written = EEPROM.bytes_written;
+    unsigned long end = millis() + 2 * SNAPSHOT_WRITE_MS;
+    while (EEPROM.bytes_written < written + 3 && millis() < end) {
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+    }
+    CHECK(EEPROM.bytes_written == written + 3);
+    delete dosa;
+
+    const char *flow = restored_flow();
+    CHECK(flow != NULL && strcmp(flow, "8.00") == 0);
+}
+
+int main() {
+    restores_after_reset();
+    corrupt_newest_slot();
+    version_mismatch();
+    spread_over_ticks();
+    reset_mid_write();
+    return check_result();
+}
@@ -0,0 +1,98 @@
+/*
+    Split EC doses: the sub-pulses of each channel add up to exactly its whole dose, so the A:B ratio is
+    kept, A and B never open together and every sub-pulse after the first gets its rest.
+*/
+
+#include <stdlib.h>
+
+#include <check.h>
+#include <rig.h>
+
+#define SPLIT_REST_MS 2000
+
+static double published(const char *topic) {
+    const char *value = host_last_publish(topic);
+    return value != NULL ? atof(value) : 0;
+}
+
+// a millisecond a tick, so the valve times come out to the ms rather than to the rig tick
+static void run_fine(Dosa_Cls *dosa, unsigned long ms) {
+    for (unsigned long i = 0; i < ms; i++) {
+        host_advance_ms(1);
+        dosa->main();
+    }
+}
+
+struct Split_Pins {
+    uint8_t opens_A;
+    uint8_t opens_B;
+    bool overlap;
+    unsigned long shortest_rest_ms;     // from any close to the next open of either channel
+};
+
+static Split_Pins walk_pins(unsigned long from_ms) {
+    Split_Pins pins = {0, 0, false, 0xffffffff};
+    bool high_A = false;
+    bool high_B = false;
+    bool closed = false;
+    unsigned long closed_ms = 0;
+    for (size_t i = 0; i < host_pin_writes.size(); i++) {
+        const Host_Pin_Write &write = host_pin_writes[i];
+        if (write.ms < from_ms || (write.pin != RIG_NUTRIENT_A_PIN && write.pin != RIG_NUTRIENT_B_PIN)) {
+            continue;
+        }
+        bool &high = write.pin == RIG_NUTRIENT_A_PIN ? high_A : high_B;
+        if (write.state && !high) {
+            if (closed && write.ms - closed_ms < pins.shortest_rest_ms) {
+                pins.shortest_rest_ms = write.ms - closed_ms;
+            }
+            if (write.pin == RIG_NUTRIENT_A_PIN) {
+                pins.opens_A++;
+            } else {
+                pins.opens_B++;
+            }
+        } else if (!write.state && high) {
+            closed = true;
+            closed_ms = write.ms;
+        }
+        high = write.state;
+        pins.overlap |= high_A && high_B;
+    }
+    return pins;
+}
+
+static void split(const char *flow, const char *ratio, uint8_t pulses) {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->ec_split_pulses = pulses;
+    dosa->split_rest_ms = SPLIT_REST_MS;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", flow);
+    rig_control(dosa, "ratio-of-A-to-B-%", ratio);
+    run_fine(dosa, 100);
+
+    double dose_A = published("status/nutrient-A-dosing-time-s");
+    double dose_B = published("status/nutrient-B-dosing-time-s");
+    unsigned long start = millis();
+    rig_control(dosa, "ec-dose", "true");
+    run_fine(dosa, dose_A + dose_B + 2 * pulses * SPLIT_REST_MS + 1000);
+
+    Split_Pins pins = walk_pins(start);
+    CHECK(rig_high_ms(RIG_NUTRIENT_A_PIN, start, millis()) == dose_A);
+    CHECK(rig_high_ms(RIG_NUTRIENT_B_PIN, start, millis()) == dose_B);
+    CHECK(pins.opens_A == (dose_A > 0 ? pulses : 0));
+    CHECK(pins.opens_B == (dose_B > 0 ? pulses : 0));
+    CHECK(!pins.overlap);
+    CHECK(pins.shortest_rest_ms >= SPLIT_REST_MS);
+    CHECK(host_pin(RIG_NUTRIENT_A_PIN) == LOW && host_pin(RIG_NUTRIENT_B_PIN) == LOW);
+    delete dosa;
+}
+
+int main() {
+    split("10", "50", 4);
+    split("7.3", "37.5", 3);
+    split("12", "100", 5);
+    split("2.5", "12", 8);
+    return check_result();
+}
@@ -0,0 +1,104 @@
+/*
+    The compact status frame: what a reconnect publishes decodes back to the doser's configuration, and the
+    retained frame follows the valves, control values and lockouts as they change, without going out again
+    while nothing does.
+*/
+
+#include <check.h>
+#include <decode.h>
+#include <rig.h>
+
+static bool last_frame(Status_Frame &frame) {
+    const char *hex = host_last_publish("status/frame");
+    return hex != NULL && decode_status_frame(hex, frame);
+}
+
+static bool frame_since(size_t from, bool (*test)(const Status_Frame &frame)) {
+    for (size_t i = from; i < host_publishes.size(); i++) {
+        Status_Frame frame;
+        if (host_publishes[i].topic == "status/frame" && decode_status_frame(host_publishes[i].value.c_str(), frame) &&
+            test(frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool A_and_B_open(const Status_Frame &frame) {
+    return frame.nutrient_A_valve && frame.nutrient_B_valve;
+}
+
+static void round_trip() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_doser();
+    dosa->publish_status_frame = true;
+    dosa->init();
+    host_set_input(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_control(dosa, "flow-rate-lpm", "12.5");
+    rig_control(dosa, "ratio-of-A-to-B-%", "40");
+    rig_control(dosa, "ph-dose-time-s", "7");
+    rig_run(dosa, 100);
+
+    // a reconnect is one frame, retained
+    size_t connected = host_publishes.size();
+    rig_device.new_mqtt_connection = true;
+    rig_run(dosa, RIG_TICK_MS);
+    rig_device.new_mqtt_connection = false;
+    rig_run(dosa, 1000);
+    unsigned frames = 0;
+    bool retained = false;
+    for (size_t i = connected; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic == "status/frame") {
+            frames++;
+            retained = host_publishes[i].retain;
+        }
+    }
+    CHECK(frames == 1 && retained);
+    CHECK(host_publish_count("status/nutrient-A-valve-pin") == 0);
+
+    Status_Frame frame;
+    CHECK(last_frame(frame));
+    CHECK(frame.version == STATUS_FRAME_VERSION);
+    CHECK(frame.ph_pin == RIG_PH_PIN && frame.mixture_pin == RIG_MIXTURE_PIN);
+    CHECK(frame.nutrient_A_pin == RIG_NUTRIENT_A_PIN && frame.nutrient_B_pin == RIG_NUTRIENT_B_PIN);
+    CHECK(frame.emergency_stop_pin == RIG_EMERGENCY_STOP_PIN);
+    CHECK_NEAR(frame.flow_rate_lpm, 12.5, 0.001);
+    CHECK_NEAR(frame.ratio_of_A_to_B, 40, 0.001);
+    CHECK(frame.ph_dose_time_s == 7);
+    CHECK_NEAR(frame.dose_amount_l, 1, 0.001);
+    // 1 l at 12.5 l/min is 4.8 s of valve time, 40 % of it A
+    CHECK_NEAR(frame.nutrient_A_time_ms, 1920, 1);
+    CHECK_NEAR(frame.nutrient_B_time_ms, 2880, 1);
+    CHECK(!frame.ec_dose && !frame.ph_dose && !frame.run_mixture && !frame.dose_lockout);
+    CHECK(!frame.nutrient_A_valve && !frame.nutrient_B_valve && !frame.ph_valve && !frame.mixture_valve);
+    CHECK(!frame.lockout_control && !frame.emergency_stop);
+
+    // a dose opens and closes the valves in the retained frame
+    size_t dosing = host_publishes.size();
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 5000);
+    CHECK(frame_since(dosing, A_and_B_open));
+    CHECK(last_frame(frame));
+    CHECK(!frame.nutrient_A_valve && !frame.nutrient_B_valve && !frame.ec_dose);
+
+    // a new control value and a lockout
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "dose-lockout", "true");
+    rig_run(dosa, 1000);
+    CHECK(last_frame(frame));
+    CHECK_NEAR(frame.flow_rate_lpm, 10, 0.001);
+    CHECK(frame.dose_lockout && frame.lockout_control);
+    // safety_dose_lockout
+    CHECK(frame.lockout_type == 1);
+
+    // nothing changes, nothing goes out
+    unsigned long published = host_publish_count("status/frame");
+    rig_run(dosa, 10000);
+    CHECK(host_publish_count("status/frame") == published);
+    delete dosa;
+}
+
+int main() {
+    round_trip();
+    return check_result();
+}
@@ -0,0 +1,139 @@
+/*
+    The outbound status queue across a broker outage: informational topics are dropped while it is away and
+    counted, safety topics go out first on reconnect ahead of the publish_status() burst, everything else
+    goes out at STATUS_PUBLISH_BUDGET a tick, and the dropped topics come back with the burst.
+*/
+
+#include <stdlib.h>
+
+#include <check.h>
+#include <rig.h>
+
+static const char *safety_topics[] = {
+    "status/doser-lockout",
+    "status/doser-safety-timer-lockout-ec",
+    "status/doser-safety-timer-lockout-ph",
+    "status/emergency-stop-button",
+    "status/safety-timer-lockout-ph",
+    "status/safety-timer-lockout-ec",
+};
+
+static bool safety_topic(const std::string &topic) {
+    for (size_t i = 0; i < sizeof(safety_topics) / sizeof(safety_topics[0]); i++) {
+        if (topic == safety_topics[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// every publish from index from on is under the same control/ or hardware/ prefix
+static bool one_group(size_t from) {
+    const std::string &first = host_publishes[from].topic;
+    std::string prefix = first.substr(0, first.find('/') + 1);
+    if (prefix != "control/" && prefix != "hardware/") {
+        return false;
+    }
+    for (size_t i = from + 1; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic.compare(0, prefix.size(), prefix) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool published_since(const char *topic, size_t from) {
+    for (size_t i = from; i < host_publishes.size(); i++) {
+        if (host_publishes[i].topic == topic) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void outage_and_reconnect() {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_run(dosa, 1000);
+
+    // the broker goes away for over a report window and the e-stop is pressed while it is gone
+    rig_device.mqtt_connected = false;
+    size_t disconnected = host_publishes.size();
+    rig_run(dosa, IDLE_REPORT_MS + 1000);
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+    rig_run(dosa, 1000);
+    CHECK(host_publishes.size() == disconnected);
+
+    // back, the bridge raises new_mqtt_connection for one tick
+    rig_device.mqtt_connected = true;
+    rig_device.new_mqtt_connection = true;
+    size_t reconnected = host_publishes.size();
+    host_advance_ms(RIG_TICK_MS);
+    dosa->main();
+    rig_device.new_mqtt_connection = false;
+
+    // the first tick leads with every safety topic, then spends the budget
+    size_t first_tick = host_publishes.size() - reconnected;
+    size_t safety = 0;
+    while (reconnected + safety < host_publishes.size() && safety_topic(host_publishes[reconnected + safety].topic)) {
+        safety++;
+    }
+    // the e-stop button and the lockout summary group
+    CHECK(safety == 4);
+    CHECK(first_tick - safety <= STATUS_PUBLISH_BUDGET);
+    const char *estop = host_last_publish("status/emergency-stop-button");
+    CHECK(estop != NULL && strcmp(estop, "true") == 0);
+
+    // no safety topic after the first tick, and no tick over budget unless it is one group going out whole
+    bool late_safety = false;
+    bool over_budget = false;
+    unsigned ticks = 0;
+    for (unsigned tick = 0; tick < 50; tick++) {
+        size_t before = host_publishes.size();
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+        for (size_t i = before; i < host_publishes.size(); i++) {
+            late_safety |= safety_topic(host_publishes[i].topic);
+        }
+        if (host_publishes.size() > before) {
+            ticks = tick + 1;
+        }
+        over_budget |= host_publishes.size() - before > STATUS_PUBLISH_BUDGET && !one_group(before);
+    }
+    printf("reconnect: %zu safety topics first, the rest over %u more ticks\n", safety, ticks);
+    CHECK(!late_safety);
+    CHECK(!over_budget);
+
+    // what was dropped in the outage went out with the burst
+    CHECK(published_since("status/emergency-stop-latency-us", reconnected));
+    CHECK(published_since("status/idle-percent", reconnected));
+    CHECK(published_since("status/recipe-step", reconnected));
+    CHECK(published_since("status/publish-queue", reconnected));
+    const char *latency = host_last_publish("status/emergency-stop-latency-us");
+    CHECK(latency != NULL && strtoul(latency, NULL, 10) == 1);
+
+    // depth, max depth, coalesced, dropped, read when it was published
+    const char *queue = host_last_publish("status/publish-queue");
+    CHECK(queue != NULL);
+    char *pos = (char *)queue;
+    unsigned long counters[4] = {0, 0, 0, 0};
+    for (uint8_t i = 0; i < 4; i++) {
+        counters[i] = strtoul(pos, &pos, 10);
+        if (*pos == ',') {
+            pos++;
+        }
+    }
+    printf("publish queue: depth %lu, max depth %lu, coalesced %lu, dropped %lu\n", counters[0], counters[1],
+           counters[2], counters[3]);
+    // the idle report and the latency histogram at least, dropped while away
+    CHECK(counters[3] >= 3);
+    // the whole burst was queued at once
+    CHECK(counters[1] >= 12);
+    delete dosa;
+}
+
+int main() {
+    outage_and_reconnect();
+    return check_result();
+}
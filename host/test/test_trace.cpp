@@ -0,0 +1,80 @@
+/*
+    DOSA_TRACE build: a session of doses, a lockout and an e-stop press is dumped over status/trace, and the
+    dump replayed into a fresh doser makes the same valve and led changes at the same times. A trace with
+    one payload changed does not, that is what a replay finds when behaviour has moved.
+*/
+
+#include <check.h>
+#include <trace_replay.h>
+
+static void record_session(std::vector<Replay_Record> &trace) {
+    rig_reset();
+    Dosa_Cls *dosa = rig_start();
+    rig_run(dosa, 1000);
+    rig_control(dosa, "flow-rate-lpm", "10");
+    rig_control(dosa, "ratio-of-A-to-B-%", "30");
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 10000);
+    rig_control(dosa, "ph-dose-time-s", "3");
+    rig_control(dosa, "ph-dose", "true");
+    rig_run(dosa, 5000);
+    rig_control(dosa, "dose-lockout", "true");
+    rig_run(dosa, 1000);
+    rig_control(dosa, "dose-lockout", "false");
+    rig_run(dosa, 1000);
+    rig_control(dosa, "ec-dose", "true");
+    rig_run(dosa, 1000);
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, LOW);
+    rig_run(dosa, 1000);
+    host_drive_interrupt(RIG_EMERGENCY_STOP_PIN, HIGH);
+    rig_run(dosa, 1000);
+    rig_control(dosa, "dose-lockout", "false");
+    rig_run(dosa, 1000);
+
+    // one record a tick
+    size_t from = host_publishes.size();
+    rig_control(dosa, "trace-dump", "true");
+    rig_run(dosa, TRACE_SIZE * RIG_TICK_MS * 2);
+    trace.clear();
+    for (size_t i = from; i < host_publishes.size(); i++) {
+        Replay_Record record;
+        if (host_publishes[i].topic == "status/trace" && parse_trace_line(host_publishes[i].value.c_str(), record)) {
+            trace.push_back(record);
+        }
+    }
+    delete dosa;
+}
+
+static void replays_the_session() {
+    std::vector<Replay_Record> trace;
+    record_session(trace);
+    size_t outputs = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+        outputs += trace[i].kind == replay_output;
+    }
+    // the whole session fits the ring, the dump request is the last record
+    CHECK(trace.size() < TRACE_SIZE);
+    CHECK(!trace.empty() && strcmp(trace.back().name, "trace-dump") == 0);
+    CHECK(outputs >= 10);
+
+    Replay_Result result = replay_trace(trace, stdout);
+    printf("%zu records, %zu inputs, %zu outputs traced, %zu replayed, %zu mismatches, %.1f s virtual\n",
+           trace.size(), result.inputs, result.outputs, result.replayed, result.mismatches,
+           result.virtual_ms / 1000.0);
+    CHECK(result.mismatches == 0);
+    CHECK(result.replayed == outputs);
+
+    // the A:B ratio changed, A and B close at other times
+    for (size_t i = 0; i < trace.size(); i++) {
+        if (strcmp(trace[i].name, "ratio-of-A-to-B-%") == 0) {
+            strcpy(trace[i].value, "60");
+        }
+    }
+    result = replay_trace(trace, NULL);
+    CHECK(result.mismatches > 0);
+}
+
+int main() {
+    replays_the_session();
+    return check_result();
+}
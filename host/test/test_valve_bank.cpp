@@ -0,0 +1,90 @@
+/*
+    The valve bank's port register path, built with __AVR__ against the host_ports stand-in: staged valves
+    on one port move in the same write, unstaged valves are left alone, and a valve an interrupt shut after
+    it was staged open is not opened again by the commit.
+*/
+
+#include <check.h>
+#include <host.h>
+#include <valve_bank.h>
+
+// pins 2 and 3 share port 0, pin 9 is on port 1
+#define PIN_A 2
+#define PIN_B 3
+#define PIN_PH 9
+
+static bool port_pin(uint8_t pin) {
+    return host_ports[digitalPinToPort(pin)] & digitalPinToBitMask(pin);
+}
+
+static void moves_together() {
+    host_reset();
+    Valve_Bank_Cls valves;
+    uint8_t forced_off = 0;
+    int8_t a = valves.add(PIN_A);
+    int8_t b = valves.add(PIN_B);
+    int8_t ph = valves.add(PIN_PH);
+    CHECK(valves.add(0) == -1);
+
+    valves.set(a, true);
+    valves.set(b, true);
+    CHECK(!port_pin(PIN_A) && !port_pin(PIN_B));
+    valves.commit(forced_off);
+    CHECK(port_pin(PIN_A) && port_pin(PIN_B) && !port_pin(PIN_PH));
+
+    valves.set(a, false);
+    valves.set(ph, true);
+    valves.commit(forced_off);
+    CHECK(!port_pin(PIN_A) && port_pin(PIN_B) && port_pin(PIN_PH));
+    CHECK(host_interrupts_enabled());
+}
+
+static void unstaged_left_alone() {
+    host_reset();
+    Valve_Bank_Cls valves;
+    uint8_t forced_off = 0;
+    int8_t a = valves.add(PIN_A);
+    int8_t b = valves.add(PIN_B);
+    valves.set(a, true);
+    valves.set(b, true);
+    valves.commit(forced_off);
+
+    // an interrupt shuts B, then main() only moves A
+    host_ports[digitalPinToPort(PIN_B)] &= ~digitalPinToBitMask(PIN_B);
+    valves.set(a, false);
+    valves.commit(forced_off);
+    CHECK(!port_pin(PIN_A) && !port_pin(PIN_B));
+}
+
+static void forced_off_not_reopened() {
+    host_reset();
+    Valve_Bank_Cls valves;
+    volatile uint8_t forced_off = 0;
+    int8_t a = valves.add(PIN_A);
+    int8_t b = valves.add(PIN_B);
+
+    // both staged open, then an interrupt shuts A before the commit
+    valves.set(a, true);
+    valves.set(b, true);
+    host_ports[digitalPinToPort(PIN_A)] &= ~digitalPinToBitMask(PIN_A);
+    forced_off |= 1 << a;
+    valves.commit(forced_off);
+    CHECK(!port_pin(PIN_A));
+    CHECK(port_pin(PIN_B));
+
+    // still held off on a later tick, and free to open once the owner clears it
+    valves.set(a, true);
+    valves.commit(forced_off);
+    CHECK(!port_pin(PIN_A));
+    forced_off = 0;
+    valves.set(a, true);
+    valves.commit(forced_off);
+    CHECK(port_pin(PIN_A) && port_pin(PIN_B));
+}
+
+int main() {
+    moves_together();
+    unstaged_left_alone();
+    forced_off_not_reopened();
+    return check_result();
+}
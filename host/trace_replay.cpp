@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <trace_replay.h>
+
+struct Output_Change {
+    unsigned long ms;
+    uint8_t pin;
+    bool state;
+    bool matched;
+};
+
+bool parse_trace_line(const char *line, Replay_Record &record) {
+    char kind[16];
+    char target[32];
+    char value[16];
+    unsigned long ms;
+    // the value is the rest of the line, a payload may itself hold commas
+    int fields = sscanf(line, "%lu,%15[^,],%31[^,],%15[^\r\n]", &ms, kind, target, value);
+    if (fields < 3) {
+        return false;
+    }
+    if (fields == 3) {
+        value[0] = '\0';
+    }
+    record.ms = ms;
+    if (strcmp(kind, "message") == 0) {
+        record.kind = replay_message;
+        record.pin = 0;
+        strcpy(record.name, target);
+    } else if (strcmp(kind, "emergency-stop") == 0 || strcmp(kind, "output") == 0) {
+        record.kind = kind[0] == 'e' ? replay_emergency_stop : replay_output;
+        record.pin = atoi(target);
+        record.name[0] = '\0';
+    } else {
+        return false;
+    }
+    strcpy(record.value, value);
+    return true;
+}
+
+static void run_until(Dosa_Cls *dosa, unsigned long ms) {
+    while (millis() + RIG_TICK_MS <= ms) {
+        host_advance_ms(RIG_TICK_MS);
+        dosa->main();
+    }
+    if (millis() < ms) {
+        host_set_millis(ms);
+    }
+}
+
+// the first unmatched change of the same pin and state within the tolerance
+static Output_Change *find_change(std::vector<Output_Change> &changes, const Output_Change &change) {
+    for (size_t i = 0; i < changes.size(); i++) {
+        Output_Change &other = changes[i];
+        unsigned long apart = other.ms > change.ms ? other.ms - change.ms : change.ms - other.ms;
+        if (!other.matched && other.pin == change.pin && other.state == change.state &&
+            apart <= REPLAY_TOLERANCE_MS) {
+            return &other;
+        }
+    }
+    return NULL;
+}
+
+Replay_Result replay_trace(const std::vector<Replay_Record> &trace, FILE *out) {
+    Replay_Result result = {0, 0, 0, 0, 0};
+    if (trace.empty()) {
+        return result;
+    }
+
+    // every rig output is watched, so a replay that moves a pin the trace never did is caught too
+    static const uint8_t rig_outputs[] = {RIG_NUTRIENT_A_PIN, RIG_NUTRIENT_B_PIN, RIG_PH_PIN, RIG_MIXTURE_PIN,
+                                          RIG_LOCKOUT_LED_PIN};
+    bool watched[HOST_PINS] = {};
+    for (size_t i = 0; i < sizeof(rig_outputs); i++) {
+        watched[rig_outputs[i]] = true;
+    }
+
+    std::vector<Output_Change> traced;
+    for (size_t i = 0; i < trace.size(); i++) {
+        if (trace[i].kind == replay_output) {
+            Output_Change change = {trace[i].ms, trace[i].pin, strcmp(trace[i].value, "1") == 0, false};
+            traced.push_back(change);
+            if (trace[i].pin < HOST_PINS) {
+                watched[trace[i].pin] = true;
+            }
+        }
+    }
+
+    // booted a second before the first record, as near to the traced doser's state as the trace tells
+    rig_reset();
+    unsigned long start = trace[0].ms > 1000 ? trace[0].ms - 1000 : 0;
+    host_set_millis(start);
+    Dosa_Cls *dosa = rig_start();
+    size_t booted = host_pin_writes.size();
+
+    for (size_t i = 0; i < trace.size(); i++) {
+        const Replay_Record &record = trace[i];
+        if (record.kind == replay_output) {
+            continue;
+        }
+        run_until(dosa, record.ms);
+        if (record.kind == replay_message) {
+            // the dump request is only in a trace build, it changes nothing else
+            if (strcmp(record.name, "trace-dump") != 0) {
+                rig_control(dosa, record.name, record.value);
+            }
+        } else if (record.value[0] == '1') {
+            host_drive_interrupt(record.pin, LOW);
+        } else {
+            host_drive_interrupt(record.pin, HIGH);
+        }
+        result.inputs++;
+    }
+    run_until(dosa, trace.back().ms + REPLAY_TAIL_MS);
+    result.virtual_ms = millis() - start;
+    delete dosa;
+
+    // the replay's output changes, as levels change rather than every write
+    std::vector<Output_Change> replayed;
+    bool level[HOST_PINS] = {};
+    for (size_t i = booted; i < host_pin_writes.size(); i++) {
+        const Host_Pin_Write &write = host_pin_writes[i];
+        if (write.pin < HOST_PINS && watched[write.pin] && write.state != level[write.pin]) {
+            level[write.pin] = write.state;
+            Output_Change change = {write.ms, write.pin, write.state, false};
+            replayed.push_back(change);
+        }
+    }
+    result.outputs = traced.size();
+    result.replayed = replayed.size();
+
+    for (size_t i = 0; i < traced.size(); i++) {
+        Output_Change *match = find_change(replayed, traced[i]);
+        if (match != NULL) {
+            match->matched = true;
+            traced[i].matched = true;
+        } else {
+            result.mismatches++;
+            if (out != NULL) {
+                fprintf(out, "- %lu pin %u %u, not in the replay\n", traced[i].ms, traced[i].pin, traced[i].state);
+            }
+        }
+    }
+    for (size_t i = 0; i < replayed.size(); i++) {
+        if (!replayed[i].matched) {
+            result.mismatches++;
+            if (out != NULL) {
+                fprintf(out, "+ %lu pin %u %u, not in the trace\n", replayed[i].ms, replayed[i].pin,
+                        replayed[i].state);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef HOST_TRACE_REPLAY_H
+#define HOST_TRACE_REPLAY_H
+
+/*
+    Replay of a DOSA_TRACE dump. The messages and e-stop edges of a trace are fed to a fresh rig doser at
+    their millis() under the virtual clock, and the valve and lockout led changes it makes are diffed
+    against the outputs the trace recorded. The doser the trace came from is taken to be wired and
+    configured as the rig, and the trace to start from its boot, a ring that has dropped records replays
+    from a different state.
+*/
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <rig.h>
+
+// traced and replayed outputs further apart than this are a mismatch, the device's ticks are not the rig's
+#define REPLAY_TOLERANCE_MS 50
+
+// run on after the last record for the outputs it starts
+#define REPLAY_TAIL_MS 30000
+
+enum replay_kind {replay_message, replay_emergency_stop, replay_output};
+
+struct Replay_Record {
+    unsigned long ms;
+    replay_kind kind;
+    char name[32];              // control topic name for messages
+    uint8_t pin;                // e-stop and output pin
+    char value[16];
+};
+
+struct Replay_Result {
+    size_t inputs;              // messages and e-stop edges fed in
+    size_t outputs;             // output changes in the trace
+    size_t replayed;            // output changes in the replay
+    size_t mismatches;          // outputs in one and not the other
+    unsigned long virtual_ms;
+};
+
+// one "<millis>,<kind>,<topic or pin>,<value>" line of a dump, false if it is not one
+bool parse_trace_line(const char *line, Replay_Record &record);
+
+// replay on a rig_reset() board, each mismatch is printed to out unless it is NULL
+Replay_Result replay_trace(const std::vector<Replay_Record> &trace, FILE *out);
+
+#endif